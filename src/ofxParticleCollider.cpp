@@ -0,0 +1,370 @@
+//
+// ofxParticleCollider.cpp
+//
+
+#include "ofxParticleCollider.h"
+
+#include <algorithm>
+
+// ------------------------------------------------------------------------
+// ofxParticleSpatialHash
+// ------------------------------------------------------------------------
+
+ofxParticleSpatialHash::ofxParticleSpatialHash()
+{
+	cellSize = inverseCellSize = 1.0f;
+	count = 0;
+	tableMask = 0;
+}
+
+void ofxParticleSpatialHash::build( const Particle* particles, int numParticles, GLfloat size )
+{
+	cellSize = MAX( 1.0f, size );
+	inverseCellSize = 1.0f / cellSize;
+	count = numParticles;
+
+	// Keep the table at roughly twice the particle count, rounded up to a power of two
+	uint32_t tableSize = 16;
+	while ( tableSize < (uint32_t)count * 2 )
+		tableSize <<= 1;
+	tableMask = tableSize - 1;
+
+	if ( (int)keys.size() < count ) keys.resize( count );
+	if ( (int)sortedIndices.size() < count ) sortedIndices.resize( count );
+	bucketStart.assign( tableSize + 1, 0 );
+
+	// Count the particles in each bucket...
+	for ( int i = 0; i < count; i++ )
+	{
+		keys[i] = cellKey( cellCoord( particles[i].position.x ), cellCoord( particles[i].position.y ) );
+		bucketStart[hashKey( keys[i] ) + 1]++;
+	}
+
+	// ...turn the counts into start offsets...
+	for ( uint32_t b = 0; b < tableSize; b++ )
+		bucketStart[b + 1] += bucketStart[b];
+
+	// ...and scatter, walking each bucket's end offset back to its start
+	for ( int i = count - 1; i >= 0; i-- )
+	{
+		uint32_t bucket = hashKey( keys[i] );
+		sortedIndices[--bucketStart[bucket + 1]] = i;
+	}
+
+	// Entry b + 1 now holds the start of bucket b, shift them into place
+	for ( uint32_t b = 0; b < tableSize; b++ )
+		bucketStart[b] = bucketStart[b + 1];
+	bucketStart[tableSize] = count;
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleCollider
+// ------------------------------------------------------------------------
+
+ofxParticleCollider::ofxParticleCollider()
+{
+	boundsMin = boundsMax = Vector2fZero;
+	boundsMode = kBoundsNone;
+	restitution = 0.5f;
+	repulsionRadius = repulsionStrength = 0.0f;
+	cellSize = 32.0f;
+}
+
+void ofxParticleCollider::setBounds( GLfloat x, GLfloat y, GLfloat width, GLfloat height, int mode )
+{
+	boundsMin = Vector2fMake( x, y );
+	boundsMax = Vector2fMake( x + width, y + height );
+	boundsMode = mode;
+}
+
+int ofxParticleCollider::addSegment( Vector2f a, Vector2f b )
+{
+	CollisionSegment s = { a, b };
+	segments.push_back( s );
+	return (int)segments.size() - 1;
+}
+
+int ofxParticleCollider::addCircle( Vector2f center, GLfloat radius )
+{
+	CollisionCircle c = { center, radius };
+	circles.push_back( c );
+	return (int)circles.size() - 1;
+}
+
+int ofxParticleCollider::addKillRect( Vector2f min, Vector2f max )
+{
+	CollisionRegion r = { min, max, Vector2fZero, 0.0f, 0 };
+	killRegions.push_back( r );
+	return (int)killRegions.size() - 1;
+}
+
+int ofxParticleCollider::addKillCircle( Vector2f center, GLfloat radius )
+{
+	CollisionRegion r = { Vector2fMake( center.x - radius, center.y - radius ), Vector2fMake( center.x + radius, center.y + radius ), center, radius, 0 };
+	killRegions.push_back( r );
+	return (int)killRegions.size() - 1;
+}
+
+int ofxParticleCollider::addTriggerRect( Vector2f min, Vector2f max )
+{
+	CollisionRegion r = { min, max, Vector2fZero, 0.0f, 0 };
+	triggers.push_back( r );
+	return (int)triggers.size() - 1;
+}
+
+int ofxParticleCollider::addTriggerCircle( Vector2f center, GLfloat radius )
+{
+	CollisionRegion r = { Vector2fMake( center.x - radius, center.y - radius ), Vector2fMake( center.x + radius, center.y + radius ), center, radius, 0 };
+	triggers.push_back( r );
+	return (int)triggers.size() - 1;
+}
+
+void ofxParticleCollider::clear()
+{
+	segments.clear();
+	circles.clear();
+	killRegions.clear();
+	triggers.clear();
+}
+
+void ofxParticleCollider::resetTriggers()
+{
+	for ( size_t i = 0; i < triggers.size(); i++ )
+		triggers[i].hits = 0;
+}
+
+void ofxParticleCollider::setRepulsion( GLfloat radius, GLfloat strength )
+{
+	repulsionRadius = MAX( 0.0f, radius );
+	repulsionStrength = strength;
+}
+
+// ------------------------------------------------------------------------
+// Process
+// ------------------------------------------------------------------------
+
+int ofxParticleCollider::process( Particle* particles, int count, GLfloat aDelta, bool respond )
+{
+	collisions.clear();
+	if ( count <= 0 ) return 0;
+
+	const GLfloat hashCellSize = MAX( cellSize, repulsionRadius );
+	hash.build( particles, count, hashCellSize );
+
+	int numKilled = 0;
+	bool moved = false;
+
+	// Fast particles can cross a segment from outside its cell, so widen segment queries
+	// by the furthest any particle moved this step
+	GLfloat maxTravel = 0.0f;
+	if ( respond && !segments.empty() )
+	{
+		for ( int i = 0; i < count; i++ )
+			maxTravel = MAX( maxTravel, Vector2fLength( Vector2fSub( particles[i].position, particles[i].prevPosition ) ) );
+	}
+
+	if ( respond )
+	{
+		if ( repulsionRadius > 0.0f && repulsionStrength != 0.0f )
+			applyRepulsion( particles, count, aDelta );
+
+		for ( size_t s = 0; s < segments.size(); s++ )
+		{
+			const CollisionSegment& seg = segments[s];
+			hash.query( MIN( seg.a.x, seg.b.x ) - maxTravel, MIN( seg.a.y, seg.b.y ) - maxTravel,
+						MAX( seg.a.x, seg.b.x ) + maxTravel, MAX( seg.a.y, seg.b.y ) + maxTravel,
+						[&]( int i ) {
+							if ( collideSegment( &particles[i], seg ) )
+								collisions.push_back( i );
+						} );
+		}
+
+		for ( size_t c = 0; c < circles.size(); c++ )
+		{
+			const CollisionCircle& circle = circles[c];
+			hash.query( circle.center.x - circle.radius, circle.center.y - circle.radius,
+						circle.center.x + circle.radius, circle.center.y + circle.radius,
+						[&]( int i ) {
+							if ( collideCircle( &particles[i], circle ) )
+								collisions.push_back( i );
+						} );
+		}
+
+		moved = !collisions.empty();
+	}
+
+	if ( boundsMode != kBoundsNone )
+	{
+		for ( int i = 0; i < count; i++ )
+		{
+			if ( !collideBounds( &particles[i] ) ) continue;
+			
+			if ( boundsMode == kBoundsWrap )
+			{
+				moved = true;
+			}
+			else if ( boundsMode == kBoundsBounce && respond )
+			{
+				collisions.push_back( i );
+				moved = true;
+			}
+			else if ( boundsMode == kBoundsKill && particles[i].timeToLive > 0 )
+			{
+				particles[i].timeToLive = 0;
+				numKilled++;
+			}
+		}
+	}
+
+	// A particle can hit several shapes in one step, report it once
+	if ( collisions.size() > 1 )
+	{
+		std::sort( collisions.begin(), collisions.end() );
+		collisions.erase( std::unique( collisions.begin(), collisions.end() ), collisions.end() );
+	}
+
+	// The responses moved particles out of the cells they were binned in, rebin them
+	// so the region queries see where they ended up
+	if ( moved && ( !killRegions.empty() || !triggers.empty() ) )
+		hash.build( particles, count, hashCellSize );
+
+	for ( size_t r = 0; r < killRegions.size(); r++ )
+	{
+		const CollisionRegion& region = killRegions[r];
+		hash.query( region.min.x, region.min.y, region.max.x, region.max.y, [&]( int i ) {
+			Particle* p = &particles[i];
+			if ( p->timeToLive > 0 && insideRegion( region, p->position ) )
+			{
+				p->timeToLive = 0;
+				numKilled++;
+			}
+		} );
+	}
+
+	for ( size_t t = 0; t < triggers.size(); t++ )
+	{
+		CollisionRegion& region = triggers[t];
+		hash.query( region.min.x, region.min.y, region.max.x, region.max.y, [&]( int i ) {
+			const Particle* p = &particles[i];
+
+			// Only count particles that crossed into the region during this step
+			if ( insideRegion( region, p->position ) && !insideRegion( region, p->prevPosition ) )
+				region.hits++;
+		} );
+	}
+
+	return numKilled;
+}
+
+bool ofxParticleCollider::insideRegion( const CollisionRegion& r, Vector2f at ) const
+{
+	if ( r.radius > 0.0f )
+	{
+		Vector2f diff = Vector2fSub( at, r.center );
+		return Vector2fDot( diff, diff ) <= r.radius * r.radius;
+	}
+
+	return at.x >= r.min.x && at.x <= r.max.x && at.y >= r.min.y && at.y <= r.max.y;
+}
+
+bool ofxParticleCollider::collideSegment( Particle* p, const CollisionSegment& s )
+{
+	// Test the path travelled this step against the segment
+	Vector2f prior = p->prevPosition;
+	Vector2f path = Vector2fSub( p->position, prior );
+	Vector2f edge = Vector2fSub( s.b, s.a );
+
+	GLfloat denom = path.x * edge.y - path.y * edge.x;
+	if ( denom == 0.0f ) return false;
+
+	Vector2f toStart = Vector2fSub( s.a, prior );
+	GLfloat t = ( toStart.x * edge.y - toStart.y * edge.x ) / denom;
+	GLfloat u = ( toStart.x * path.y - toStart.y * path.x ) / denom;
+	if ( t < 0.0f || t > 1.0f || u < 0.0f || u > 1.0f ) return false;
+
+	// Normal facing the side the particle came from
+	Vector2f normal = Vector2fNormalize( Vector2fMake( -edge.y, edge.x ) );
+	if ( Vector2fDot( normal, path ) > 0.0f )
+		normal = Vector2fMultiply( normal, -1.0f );
+
+	// Stop just short of the segment and reflect the velocity
+	Vector2f hit = Vector2fAdd( prior, Vector2fMultiply( path, t ) );
+	p->position = Vector2fAdd( hit, Vector2fMultiply( normal, 0.01f ) );
+	GLfloat vn = Vector2fDot( p->direction, normal );
+	p->direction = Vector2fSub( p->direction, Vector2fMultiply( normal, ( 1.0f + restitution ) * vn ) );
+
+	return true;
+}
+
+bool ofxParticleCollider::collideCircle( Particle* p, const CollisionCircle& c )
+{
+	Vector2f diff = Vector2fSub( p->position, c.center );
+	GLfloat distanceSq = Vector2fDot( diff, diff );
+	if ( distanceSq >= c.radius * c.radius ) return false;
+
+	GLfloat distance = sqrtf( distanceSq );
+	Vector2f normal = distance > 0.0f ? Vector2fMultiply( diff, 1.0f / distance ) : Vector2fMake( 0.0f, -1.0f );
+
+	// Push the particle back onto the surface and reflect it if still moving inwards
+	p->position = Vector2fAdd( c.center, Vector2fMultiply( normal, c.radius ) );
+	GLfloat vn = Vector2fDot( p->direction, normal );
+	if ( vn < 0.0f )
+		p->direction = Vector2fSub( p->direction, Vector2fMultiply( normal, ( 1.0f + restitution ) * vn ) );
+
+	return true;
+}
+
+bool ofxParticleCollider::collideBounds( Particle* p )
+{
+	bool outside = false;
+
+	for ( int axis = 0; axis < 2; axis++ )
+	{
+		GLfloat& pos = axis == 0 ? p->position.x : p->position.y;
+		GLfloat& vel = axis == 0 ? p->direction.x : p->direction.y;
+		GLfloat lo = axis == 0 ? boundsMin.x : boundsMin.y;
+		GLfloat hi = axis == 0 ? boundsMax.x : boundsMax.y;
+
+		if ( pos >= lo && pos <= hi ) continue;
+		outside = true;
+
+		if ( boundsMode == kBoundsBounce )
+		{
+			pos = pos < lo ? lo : hi;
+			vel = ( pos == lo ? fabsf( vel ) : -fabsf( vel ) ) * restitution;
+		}
+		else if ( boundsMode == kBoundsWrap && hi > lo )
+		{
+			pos = lo + fmodf( fmodf( pos - lo, hi - lo ) + ( hi - lo ), hi - lo );
+		}
+	}
+
+	return outside;
+}
+
+void ofxParticleCollider::applyRepulsion( Particle* particles, int count, GLfloat aDelta )
+{
+	repulsion.assign( count, Vector2fZero );
+
+	const GLfloat radiusSq = repulsionRadius * repulsionRadius;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		const Vector2f pi = particles[i].position;
+		hash.query( pi.x - repulsionRadius, pi.y - repulsionRadius, pi.x + repulsionRadius, pi.y + repulsionRadius, [&]( int j ) {
+			if ( j == i ) return;
+
+			Vector2f diff = Vector2fSub( pi, particles[j].position );
+			GLfloat distanceSq = Vector2fDot( diff, diff );
+			if ( distanceSq >= radiusSq || distanceSq <= 0.0f ) return;
+
+			GLfloat distance = sqrtf( distanceSq );
+			GLfloat push = repulsionStrength * ( 1.0f - distance / repulsionRadius ) / distance;
+			repulsion[i] = Vector2fAdd( repulsion[i], Vector2fMultiply( diff, push ) );
+		} );
+	}
+
+	// Apply afterwards so the result doesn't depend on particle order
+	for ( int i = 0; i < count; i++ )
+		particles[i].direction = Vector2fAdd( particles[i].direction, Vector2fMultiply( repulsion[i], aDelta ) );
+}
@@ -0,0 +1,181 @@
+//
+// ofxParticleCollider.h
+//
+// Collision and interaction stage run by an emitter after integration.  Handles world
+// bounds, line segments, solid circles, kill regions, trigger regions and optional
+// particle to particle repulsion.  All queries go through a uniform grid spatial hash
+// that is rebuilt every step with a counting sort, so the cost stays near linear in
+// the number of particles.
+//
+
+#ifndef _OFX_PARTICLE_COLLIDER
+#define _OFX_PARTICLE_COLLIDER
+
+#include "ofxParticleEmitter.h"
+
+// What happens to particles that leave the world bounds
+enum kBoundsModes
+{
+	kBoundsNone,
+	kBoundsBounce,
+	kBoundsKill,
+	kBoundsWrap
+};
+
+typedef struct
+{
+	Vector2f	a, b;
+} CollisionSegment;
+
+typedef struct
+{
+	Vector2f	center;
+	GLfloat		radius;
+} CollisionCircle;
+
+// Axis aligned region, or a circle when radius is greater than zero
+typedef struct
+{
+	Vector2f	min, max;
+	Vector2f	center;
+	GLfloat		radius;
+	int			hits;		// Trigger regions only, particles that entered since resetTriggers()
+} CollisionRegion;
+
+// ------------------------------------------------------------------------
+// ofxParticleSpatialHash
+// ------------------------------------------------------------------------
+
+class ofxParticleSpatialHash
+{
+
+public:
+
+	ofxParticleSpatialHash();
+
+	// Bins the particles into cells of the given size.  Buckets are laid out with a
+	// counting sort so each bucket's particles are contiguous
+	void	build( const Particle* particles, int count, GLfloat cellSize );
+
+	// Calls fn( index ) once for every particle whose cell overlaps the rectangle
+	template<typename F>
+	void	query( GLfloat minX, GLfloat minY, GLfloat maxX, GLfloat maxY, F fn ) const
+	{
+		if ( count == 0 ) return;
+
+		int minCX = cellCoord( minX ), maxCX = cellCoord( maxX );
+		int minCY = cellCoord( minY ), maxCY = cellCoord( maxY );
+
+		// A region covering more cells than there are particles is cheaper to scan directly
+		if ( (double)( maxCX - minCX + 1 ) * ( maxCY - minCY + 1 ) > count )
+		{
+			for ( int i = 0; i < count; i++ )
+			{
+				int cx = (int)( keys[i] >> 32 ), cy = (int)( keys[i] & 0xffffffff );
+				if ( cx >= minCX && cx <= maxCX && cy >= minCY && cy <= maxCY )
+					fn( i );
+			}
+			return;
+		}
+
+		for ( int cy = minCY; cy <= maxCY; cy++ )
+		{
+			for ( int cx = minCX; cx <= maxCX; cx++ )
+			{
+				uint64_t key = cellKey( cx, cy );
+				uint32_t bucket = hashKey( key );
+				for ( int j = bucketStart[bucket]; j < bucketStart[bucket + 1]; j++ )
+				{
+					// Buckets are shared by hash collisions, only take this cell's particles
+					if ( keys[sortedIndices[j]] == key )
+						fn( sortedIndices[j] );
+				}
+			}
+		}
+	}
+
+	GLfloat	getCellSize() const { return cellSize; }
+
+protected:
+
+	inline int		cellCoord( GLfloat v ) const { return (int)floorf( v * inverseCellSize ); }
+	inline uint64_t	cellKey( int cx, int cy ) const { return ( (uint64_t)(uint32_t)cx << 32 ) | (uint32_t)cy; }
+	inline uint32_t	hashKey( uint64_t key ) const
+	{
+		uint32_t cx = (uint32_t)( key >> 32 ), cy = (uint32_t)key;
+		return ( cx * 73856093u ^ cy * 19349663u ) & tableMask;
+	}
+
+	GLfloat				cellSize, inverseCellSize;
+	int					count;
+	uint32_t			tableMask;
+	vector<uint64_t>	keys;			// Cell of each particle, by particle index
+	vector<int>			bucketStart;	// tableSize + 1 prefix sums
+	vector<int>			sortedIndices;	// Particle indices grouped by bucket
+};
+
+// ------------------------------------------------------------------------
+// ofxParticleCollider
+// ------------------------------------------------------------------------
+
+class ofxParticleCollider
+{
+
+public:
+
+	ofxParticleCollider();
+
+	void	setBounds( GLfloat x, GLfloat y, GLfloat width, GLfloat height, int mode );
+	void	setRestitution( GLfloat restitution ) { this->restitution = restitution; }
+
+	int		addSegment( Vector2f a, Vector2f b );
+	int		addCircle( Vector2f center, GLfloat radius );
+	int		addKillRect( Vector2f min, Vector2f max );
+	int		addKillCircle( Vector2f center, GLfloat radius );
+	int		addTriggerRect( Vector2f min, Vector2f max );
+	int		addTriggerCircle( Vector2f center, GLfloat radius );
+	void	clear();
+
+	int		getTriggerHits( int trigger ) const { return triggers[trigger].hits; }
+	void	resetTriggers();
+
+	// Pushes particles closer than radius apart.  A radius of 0 disables repulsion
+	void	setRepulsion( GLfloat radius, GLfloat strength );
+
+	// Grid cell size used for queries, defaults to 32 or the repulsion radius if larger
+	void	setCellSize( GLfloat cellSize ) { this->cellSize = cellSize; }
+
+	// Runs the stage over the live particles.  Only particles that move freely
+	// (gravity type) are deflected; kill and trigger regions apply to all types.
+	// Paths run from each particle's prevPosition to its position.  Killed particles
+	// get a timeToLive of 0, the return value is how many were killed
+	int		process( Particle* particles, int count, GLfloat aDelta, bool respond );
+	
+	// Indices of the particles deflected by the last process() call
+	const vector<int>&	getCollisions() const { return collisions; }
+
+	vector<CollisionSegment>	segments;
+	vector<CollisionCircle>		circles;
+	vector<CollisionRegion>		killRegions;
+	vector<CollisionRegion>		triggers;
+
+protected:
+
+	bool	insideRegion( const CollisionRegion& r, Vector2f at ) const;
+	bool	collideSegment( Particle* p, const CollisionSegment& s );
+	bool	collideCircle( Particle* p, const CollisionCircle& c );
+	bool	collideBounds( Particle* p );
+	void	applyRepulsion( Particle* particles, int count, GLfloat aDelta );
+
+	Vector2f	boundsMin, boundsMax;
+	int			boundsMode;
+	GLfloat		restitution;
+	GLfloat		repulsionRadius, repulsionStrength;
+	GLfloat		cellSize;
+
+	ofxParticleSpatialHash	hash;
+	vector<Vector2f>		repulsion;		// Scratch, accumulated push per particle
+	vector<int>				collisions;
+};
+
+#endif
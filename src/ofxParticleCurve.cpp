@@ -0,0 +1,176 @@
+//
+// ofxParticleCurve.cpp
+//
+
+#include "ofxParticleCurve.h"
+
+template<typename T>
+static bool keyTimeLess( const pair<GLfloat, T>& a, const pair<GLfloat, T>& b )
+{
+	return a.first < b.first;
+}
+
+// Position of LUT entry i between the two keys surrounding it, k is advanced as needed
+template<typename T>
+static GLfloat keySpan( const vector< pair<GLfloat, T> >& keys, int i, size_t& k )
+{
+	GLfloat t = (GLfloat)i / ( PARTICLE_LUT_SIZE - 1 );
+	while ( k + 2 < keys.size() && t > keys[k + 1].first )
+		k++;
+
+	GLfloat span = keys[k + 1].first - keys[k].first;
+	GLfloat f = span > 0.0f ? ( t - keys[k].first ) / span : 1.0f;
+	return f < 0.0f ? 0.0f : ( f > 1.0f ? 1.0f : f );
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleCurve
+// ------------------------------------------------------------------------
+
+bool ofxParticleCurve::load( ofxXmlSettings& settings, const std::string& tag )
+{
+	clear();
+
+	if ( !settings.tagExists( tag ) )
+		return false;
+
+	period = settings.getAttribute( tag, "period", 0.0 );
+
+	settings.pushTag( tag );
+	int numKeys = settings.getNumTags( "key" );
+	for ( int i = 0; i < numKeys; i++ )
+	{
+		GLfloat time = settings.getAttribute( "key", "time", 0.0, i );
+		GLfloat value = settings.getAttribute( "key", "value", 1.0, i );
+		addKey( time, value );
+	}
+	settings.popTag();
+
+	if ( keys.empty() )
+	{
+		ofLog( OF_LOG_WARNING, "ofxParticleCurve::load() - " + tag + " has no keys, ignoring" );
+		return false;
+	}
+
+	bake();
+	return true;
+}
+
+void ofxParticleCurve::addKey( GLfloat time, GLfloat value )
+{
+	keys.push_back( make_pair( time, value ) );
+}
+
+void ofxParticleCurve::clear()
+{
+	keys.clear();
+	enabled = false;
+	period = 0.0f;
+}
+
+void ofxParticleCurve::bake()
+{
+	if ( keys.empty() )
+	{
+		enabled = false;
+		return;
+	}
+
+	std::stable_sort( keys.begin(), keys.end(), keyTimeLess<GLfloat> );
+
+	if ( keys.size() == 1 )
+	{
+		for ( int i = 0; i < PARTICLE_LUT_SIZE; i++ )
+			lut[i] = keys[0].second;
+	}
+	else
+	{
+		size_t k = 0;
+		for ( int i = 0; i < PARTICLE_LUT_SIZE; i++ )
+		{
+			GLfloat f = keySpan( keys, i, k );
+			lut[i] = keys[k].second + ( keys[k + 1].second - keys[k].second ) * f;
+		}
+	}
+
+	enabled = true;
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleGradient
+// ------------------------------------------------------------------------
+
+bool ofxParticleGradient::load( ofxXmlSettings& settings, const std::string& tag )
+{
+	clear();
+
+	if ( !settings.tagExists( tag ) )
+		return false;
+
+	settings.pushTag( tag );
+	int numKeys = settings.getNumTags( "key" );
+	for ( int i = 0; i < numKeys; i++ )
+	{
+		ofFloatColor color;
+		GLfloat time = settings.getAttribute( "key", "time", 0.0, i );
+		color.r = settings.getAttribute( "key", "red", 1.0, i );
+		color.g = settings.getAttribute( "key", "green", 1.0, i );
+		color.b = settings.getAttribute( "key", "blue", 1.0, i );
+		color.a = settings.getAttribute( "key", "alpha", 1.0, i );
+		addKey( time, color );
+	}
+	settings.popTag();
+
+	if ( keys.empty() )
+	{
+		ofLog( OF_LOG_WARNING, "ofxParticleGradient::load() - " + tag + " has no keys, ignoring" );
+		return false;
+	}
+
+	bake();
+	return true;
+}
+
+void ofxParticleGradient::addKey( GLfloat time, const ofFloatColor& color )
+{
+	keys.push_back( make_pair( time, color ) );
+}
+
+void ofxParticleGradient::clear()
+{
+	keys.clear();
+	enabled = false;
+}
+
+void ofxParticleGradient::bake()
+{
+	if ( keys.empty() )
+	{
+		enabled = false;
+		return;
+	}
+
+	std::stable_sort( keys.begin(), keys.end(), keyTimeLess<ofFloatColor> );
+
+	if ( keys.size() == 1 )
+	{
+		for ( int i = 0; i < PARTICLE_LUT_SIZE; i++ )
+			lut[i] = keys[0].second;
+	}
+	else
+	{
+		size_t k = 0;
+		for ( int i = 0; i < PARTICLE_LUT_SIZE; i++ )
+		{
+			GLfloat f = keySpan( keys, i, k );
+			const ofFloatColor& a = keys[k].second;
+			const ofFloatColor& b = keys[k + 1].second;
+			lut[i].r = a.r + ( b.r - a.r ) * f;
+			lut[i].g = a.g + ( b.g - a.g ) * f;
+			lut[i].b = a.b + ( b.b - a.b ) * f;
+			lut[i].a = a.a + ( b.a - a.a ) * f;
+		}
+	}
+
+	enabled = true;
+}
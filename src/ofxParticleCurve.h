@@ -0,0 +1,85 @@
+//
+// ofxParticleCurve.h
+//
+// Multi-key curves and color gradients over a particle's normalized age (or over an
+// emitter's duration).  Keys are baked into a small lookup table when loaded so
+// sampling is a single indexed read per particle.
+//
+
+#ifndef _OFX_PARTICLE_CURVE
+#define _OFX_PARTICLE_CURVE
+
+#include "ofMain.h"
+#include "ofxXmlSettings.h"
+
+#define PARTICLE_LUT_SIZE 256		// Entries in a baked curve or gradient
+
+// Map a normalized 0..1 position to a lookup table index, clamping outside the range
+static inline int particleLUTIndex( GLfloat t )
+{
+	int i = (int)( t * ( PARTICLE_LUT_SIZE - 1 ) + 0.5f );
+	return i < 0 ? 0 : ( i > PARTICLE_LUT_SIZE - 1 ? PARTICLE_LUT_SIZE - 1 : i );
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleCurve
+// ------------------------------------------------------------------------
+
+class ofxParticleCurve
+{
+
+public:
+
+	ofxParticleCurve() : enabled( false ), period( 0.0f ) {}
+
+	// Reads <tag period=".."><key time=".." value=".."/>...</tag> from the current
+	// level of settings.  Returns false, leaving the curve disabled, if there is none
+	bool	load( ofxXmlSettings& settings, const std::string& tag );
+
+	void	addKey( GLfloat time, GLfloat value );
+	void	clear();
+	void	bake();
+
+	inline GLfloat	sample( GLfloat t ) const { return lut[particleLUTIndex( t )]; }
+
+	bool	isEnabled() const { return enabled; }
+	GLfloat	getPeriod() const { return period; }		// Optional length in seconds, 0 if not given
+
+protected:
+
+	bool							enabled;
+	GLfloat							period;
+	vector< pair<GLfloat, GLfloat> >	keys;
+	GLfloat							lut[PARTICLE_LUT_SIZE];
+};
+
+// ------------------------------------------------------------------------
+// ofxParticleGradient
+// ------------------------------------------------------------------------
+
+class ofxParticleGradient
+{
+
+public:
+
+	ofxParticleGradient() : enabled( false ) {}
+
+	// Reads <tag><key time=".." red=".." green=".." blue=".." alpha=".."/>...</tag>
+	bool	load( ofxXmlSettings& settings, const std::string& tag );
+
+	void	addKey( GLfloat time, const ofFloatColor& color );
+	void	clear();
+	void	bake();
+
+	inline const ofFloatColor&	sample( GLfloat t ) const { return lut[particleLUTIndex( t )]; }
+
+	bool	isEnabled() const { return enabled; }
+
+protected:
+
+	bool								enabled;
+	vector< pair<GLfloat, ofFloatColor> >	keys;
+	ofFloatColor						lut[PARTICLE_LUT_SIZE];
+};
+
+#endif
@@ -22,6 +22,13 @@
 // THE SOFTWARE.
 
 #include "ofxParticleEmitter.h"
+#include "ofxParticleForceField.h"
+#include "ofxParticleCollider.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLE_USE_SSE 1
+#endif
 
 // ------------------------------------------------------------------------
 // Lifecycle
@@ -60,12 +67,41 @@ ofxParticleEmitter::ofxParticleEmitter()
 	maxRadius = maxRadiusVariance = radiusSpeed = minRadius = 0.0f;
 	rotatePerSecond = rotatePerSecondVariance = 0.0f;
 	
-	active = useTexture = false;
+	active = false;
+	useTexture = true;
 	particleIndex = 0;
 
 	verticesID = 0;
 	particles = NULL;
 	vertices = NULL;
+	verticesDirty = false;
+	fillAlpha = 1.0f;
+	
+	threaded = false;
+	frontVertices = NULL;
+	frontCount = 0;
+	filledCount = 0;
+	frontActive = false;
+	worker = NULL;
+	workPending = workerExit = false;
+	pendingDelta = 0.0f;
+	
+	fixedTimestep = fixedAccumulator = 0.0f;
+	
+	updateInterval = 1;
+	slicePhase = 0;
+	slicePending = false;
+	
+	forceField = NULL;
+	collider = NULL;
+	
+	eventMask = eventTypes = 0;
+	
+	sortMode = kParticleSortNone;
+	sortAxis = Vector2fMake( 0.0f, 1.0f );
+	sortScratch = NULL;
+	
+	rng.setSeed( (uint32_t)( (uintptr_t)this >> 4 ) * 2654435761u );
 }
 
 ofxParticleEmitter::~ofxParticleEmitter()
@@ -75,25 +111,43 @@ ofxParticleEmitter::~ofxParticleEmitter()
 
 void ofxParticleEmitter::exit()
 {	
+	setThreaded( false );
+	
 	if ( texture != NULL )
 		delete texture;
 	texture = NULL;
 	
 	if ( particles != NULL )
-		delete particles;
+		free( particles );
 	particles = NULL;
 	
 	if ( vertices != NULL )
-		delete vertices;
+		free( vertices );
 	vertices = NULL;
 	
-	glDeleteBuffers( 1, &verticesID );
+	if ( frontVertices != NULL )
+		free( frontVertices );
+	frontVertices = NULL;
+	frontCount = filledCount = 0;
+	
+	if ( sortScratch != NULL )
+		free( sortScratch );
+	sortScratch = NULL;
+	
+	clearSubEmitters();
+	
+	if ( verticesID != 0 )
+		glDeleteBuffers( 1, &verticesID );
+	verticesID = 0;
 }
 
 bool ofxParticleEmitter::loadFromXml( const std::string& filename )
 {
 	bool ok = false;
 	
+	// Make sure a worker isn't still writing into the arrays we are about to replace
+	sync();
+	
 	settings = new ofxXmlSettings();
 	
 	ok = settings->loadFile( filename );
@@ -129,11 +183,12 @@ void ofxParticleEmitter::parseParticleConfig()
 		ofLog( OF_LOG_WARNING, "ofxParticleEmitter::parseParticleConfig() - loading image file " + imageFilename);
 		
 		texture = new ofImage();
+		texture->setUseTexture( useTexture );
 		texture->load( imageFilename );
-		texture->setUseTexture( true );
 		texture->setAnchorPercent( 0.5f, 0.5f );
 		
-		textureData = texture->getTexture().getTextureData();
+		if ( useTexture )
+			textureData = texture->getTexture().getTextureData();
 	}
 	else if ( imageData != "" )
 	{
@@ -197,10 +252,25 @@ void ofxParticleEmitter::parseParticleConfig()
 	
 	rotatePerSecond				= settings->getAttribute( "rotatePerSecond", "value", rotatePerSecond );
 	rotatePerSecondVariance		= settings->getAttribute( "rotatePerSecondVariance", "value", rotatePerSecondVariance );
+	
+	// Lifetime curves are an extension to the Particle Designer format, baked on load
+	colorGradient.load( *settings, "colorGradient" );
+	alphaCurve.load( *settings, "alphaCurve" );
+	sizeCurve.load( *settings, "sizeCurve" );
+	emissionRateCurve.load( *settings, "emissionRateCurve" );
 }
 
 void ofxParticleEmitter::setupArrays()
 {
+	// Release any arrays from a previous configuration
+	if ( particles != NULL ) free( particles );
+	if ( vertices != NULL ) free( vertices );
+	if ( frontVertices != NULL ) free( frontVertices );
+	if ( sortScratch != NULL ) free( sortScratch );
+	frontVertices = NULL;
+	sortScratch = NULL;
+	frontCount = filledCount = 0;
+	
 	// Allocate the memory necessary for the particle emitter arrays
 	particles = (Particle*)malloc( sizeof( Particle ) * maxParticles );
 	vertices = (PointSprite*)malloc( sizeof( PointSprite ) * maxParticles );
@@ -208,11 +278,20 @@ void ofxParticleEmitter::setupArrays()
 	// If one of the arrays cannot be allocated throw an assertion as this is bad
 	assert( particles && vertices );
 	
+	// The front buffer is only needed when update and draw are pipelined
+	if ( threaded )
+	{
+		frontVertices = (PointSprite*)malloc( sizeof( PointSprite ) * maxParticles );
+		assert( frontVertices );
+	}
+	
 	// Generate the vertices VBO
-	glGenBuffers( 1, &verticesID );
+	if ( useTexture && verticesID == 0 )
+		glGenBuffers( 1, &verticesID );
 	
 	// Set the particle count to zero
 	particleCount = 0;
+	verticesDirty = false;
 	
 	// Reset the elapsed time
 	elapsedTime = 0;
@@ -235,6 +314,8 @@ bool ofxParticleEmitter::addParticle()
 	// Increment the particle count
 	particleCount++;
 	
+	recordEvent( kParticleEventBirth, particle );
+	
 	// Return true to show that a particle has been created
 	return true;
 }
@@ -244,8 +325,16 @@ void ofxParticleEmitter::initParticle( Particle* particle )
 	// Init the position of the particle.  This is based on the source position of the particle emitter
 	// plus a configured variance.  The RANDOM_MINUS_1_TO_1 macro allows the number to be both positive
 	// and negative
-	particle->position.x = sourcePosition.x + sourcePositionVariance.x * RANDOM_MINUS_1_TO_1();
-	particle->position.y = sourcePosition.y + sourcePositionVariance.y * RANDOM_MINUS_1_TO_1();
+	if ( shape.getType() == kEmitterShapeBox ) {
+		particle->position.x = sourcePosition.x + sourcePositionVariance.x * RANDOM_MINUS_1_TO_1();
+		particle->position.y = sourcePosition.y + sourcePositionVariance.y * RANDOM_MINUS_1_TO_1();
+	} else {
+		// Other shapes give an offset from the source position
+		GLfloat u0 = RANDOM_0_TO_1(), u1 = RANDOM_0_TO_1(), u2 = RANDOM_0_TO_1(), u3 = RANDOM_0_TO_1();
+		shape.sample( u0, u1, u2, u3, particle->position.x, particle->position.y );
+		particle->position.x += sourcePosition.x;
+		particle->position.y += sourcePosition.y;
+	}
     particle->startPos.x = sourcePosition.x;
     particle->startPos.y = sourcePosition.y;
 	
@@ -274,12 +363,14 @@ void ofxParticleEmitter::initParticle( Particle* particle )
 	
 	// Calculate the particles life span using the life span and variance passed in
 	particle->timeToLive = MAX(0, particleLifespan + particleLifespanVariance * RANDOM_MINUS_1_TO_1());
+	particle->inverseLifespan = particle->timeToLive > 0 ? 1.0f / particle->timeToLive : 0.0f;
 	
 	// Calculate the particle size using the start and finish particle sizes
 	GLfloat particleStartSize = startParticleSize + startParticleSizeVariance * RANDOM_MINUS_1_TO_1();
 	GLfloat particleFinishSize = finishParticleSize + finishParticleSizeVariance * RANDOM_MINUS_1_TO_1();
 	particle->particleSizeDelta = ((particleFinishSize - particleStartSize) / particle->timeToLive) * (1.0 / MAXIMUM_UPDATE_RATE);
 	particle->particleSize = MAX(0, particleStartSize);
+	particle->baseSize = particle->particleSize;
 	
 	// Calculate the color the particle should have when it starts its life.  All the elements
 	// of the start color passed in along with the variance are used to calculate the star color
@@ -303,6 +394,10 @@ void ofxParticleEmitter::initParticle( Particle* particle )
 	// loop is using a fixed delta value we can calculate the delta color once saving cycles in the 
 	// update method
 	particle->color = start;
+	particle->prevColor = start;
+	particle->prevPosition = particle->position;
+	particle->prevParticleSize = particle->particleSize;
+	particle->pendingTime = 0.0f;
 	particle->deltaColor.r = ((end.r - start.r) / particle->timeToLive) * (1.0 / MAXIMUM_UPDATE_RATE);
 	particle->deltaColor.g = ((end.g - start.g) / particle->timeToLive)  * (1.0 / MAXIMUM_UPDATE_RATE);
 	particle->deltaColor.b = ((end.b - start.b) / particle->timeToLive)  * (1.0 / MAXIMUM_UPDATE_RATE);
@@ -322,121 +417,772 @@ void ofxParticleEmitter::stopParticleEmitter()
 
 void ofxParticleEmitter::update()
 {
+	// In threaded mode wait for the previous frame before touching any state.  The
+	// worker may have stopped the emitter, draw() sees that from here on
+	if ( threaded )
+	{
+		sync();
+		flushSubEmitters();
+		frontActive = active;
+	}
+	
 	if ( !active ) return;
+	
+	GLfloat aDelta = frameDelta();
+	reserveSubEmitters();
+	
+	if ( threaded )
+	{
+		// Publish the frame the worker just finished and start on the next one.  Particles
+		// spawned since then have no vertices yet, they show up with the next frame
+		std::swap( vertices, frontVertices );
+		frontCount = filledCount;
+		
+		std::unique_lock<std::mutex> lock( workerMutex );
+		pendingDelta = aDelta;
+		workPending = true;
+		workerCondition.notify_all();
+	}
+	else
+	{
+		simulate( aDelta );
+		flushSubEmitters();
+	}
+}
 
+GLfloat ofxParticleEmitter::frameDelta()
+{
+	int now = ofGetElapsedTimeMillis();
+	GLfloat aDelta = (now-lastUpdateMillis)/1000.0f;
+	lastUpdateMillis = now;
+	
+	return aDelta;
+}
+
+void ofxParticleEmitter::simulate( GLfloat aDelta )
+{
+	if ( fixedTimestep > 0.0f )
+	{
+		// Step the simulation at a fixed rate, carrying the remainder over to the next
+		// frame.  Stepping is capped so a long stall can't snowball into longer frames
+		fixedAccumulator += aDelta;
+		if ( fixedAccumulator > fixedTimestep * MAXIMUM_FIXED_STEPS )
+			fixedAccumulator = fixedTimestep * MAXIMUM_FIXED_STEPS;
+		
+		// Per particle deltas are calibrated for MAXIMUM_UPDATE_RATE steps per second,
+		// scale them so a particle's look doesn't depend on the chosen step rate
+		GLfloat deltaScale = fixedTimestep * MAXIMUM_UPDATE_RATE;
+		
+		while ( fixedAccumulator >= fixedTimestep )
+		{
+			step( fixedTimestep, deltaScale, true );
+			fixedAccumulator -= fixedTimestep;
+		}
+		
+		sortParticles();
+		finishFrame( fixedAccumulator / fixedTimestep );
+	}
+	else
+	{
+		if ( usesTimeSlicing() )
+			stepSliced( aDelta );
+		else
+			step( aDelta, 1.0f, false );
+		sortParticles();
+		finishFrame( 1.0f );
+	}
+}
+
+void ofxParticleEmitter::step( GLfloat aDelta, GLfloat deltaScale, bool keepPrevious )
+{
+	emitParticles( aDelta );
+	integrateRange( 0, particleCount, aDelta, deltaScale, keepPrevious );
+	finishStep( aDelta );
+}
+
+void ofxParticleEmitter::stepSliced( GLfloat aDelta )
+{
+	emitParticles( aDelta );
+	integrateSlice( aDelta );
+	finishStep( aDelta );
+}
+
+void ofxParticleEmitter::emitParticles( GLfloat aDelta )
+{
 	// Calculate the emission rate
 	emissionRate = maxParticles / particleLifespan;
-
-	GLfloat aDelta = (ofGetElapsedTimeMillis()-lastUpdateMillis)/1000.0f;
+	
+	// Scale the rate by the emission curve at the current point of the duration
+	if ( emissionRateCurve.isEnabled() ) {
+		GLfloat period = emissionRateCurve.getPeriod() > 0 ? emissionRateCurve.getPeriod() : duration;
+		if ( period > 0 )
+			emissionRate *= MAX(0, emissionRateCurve.sample(fmodf(elapsedTime, period) / period));
+	}
 	
 	// If the emitter is active and the emission rate is greater than zero then emit
-	// particles
-	if(active && emissionRate) {
-		float rate = 1.0f/emissionRate;
-		emitCounter += aDelta;
-		while(particleCount < maxParticles && emitCounter > rate) {
-			addParticle();
-			emitCounter -= rate;
+	// particles.  Time runs on while the curve holds the rate at zero so the duration
+	// still ends the emitter
+	if(active) {
+		if(emissionRate) {
+			float rate = 1.0f/emissionRate;
+			emitCounter += aDelta;
+			while(particleCount < maxParticles && emitCounter > rate) {
+				addParticle();
+				emitCounter -= rate;
+			}
 		}
 		
 		elapsedTime += aDelta;
 		if(duration != -1 && duration < elapsedTime)
 			stopParticleEmitter();
 	}
+}
+
+void ofxParticleEmitter::integrateRange( int begin, int end, GLfloat aDelta, GLfloat deltaScale, bool keepPrevious )
+{
+	// Only touches particles in [begin, end) so disjoint ranges can be integrated in
+	// parallel.  Particles that die are left in place for finishStep() to remove
+	for ( int index = begin; index < end; index++ )
+		integrateParticle( &particles[index], aDelta, deltaScale, keepPrevious );
+}
+
+inline void ofxParticleEmitter::integrateParticle( Particle* currentParticle, GLfloat aDelta, GLfloat deltaScale, bool keepPrevious )
+{
+    // FIX 1
+    // Reduce the life span of the particle
+    currentParticle->timeToLive -= aDelta;
 	
-	// Reset the particle index before updating the particles in this emitter
-	particleIndex = 0;
-	
-	// Loop through all the particles updating their location and color
-	while(particleIndex < particleCount) {
+	// If the current particle is alive then update it
+	if(currentParticle->timeToLive > 0) {
+		
+		// Remember where the particle was so the collider can sweep its path and
+		// rendering can interpolate between steps
+		currentParticle->prevPosition = currentParticle->position;
+		if (keepPrevious) {
+			currentParticle->prevColor = currentParticle->color;
+			currentParticle->prevParticleSize = currentParticle->particleSize;
+		}
+		
+		// If maxRadius is greater than 0 then the particles are going to spin otherwise
+		// they are effected by speed and gravity
+		if (emitterType == kParticleTypeRadial) {
+			
+            // FIX 2
+            // Update the angle of the particle from the sourcePosition and the radius.  This is only
+			// done of the particles are rotating
+			currentParticle->angle += currentParticle->degreesPerSecond * aDelta;
+			currentParticle->radius -= currentParticle->radiusDelta * deltaScale;
+            
+			Vector2f tmp;
+			tmp.x = sourcePosition.x - cosf(currentParticle->angle) * currentParticle->radius;
+			tmp.y = sourcePosition.y - sinf(currentParticle->angle) * currentParticle->radius;
+			currentParticle->position = tmp;
+			
+			if (currentParticle->radius < minRadius)
+				currentParticle->timeToLive = 0;
+		} else {
+			Vector2f tmp, radial, tangential, field;
+            
+            // Sample the force field at the particle's world position
+            field = forceField != NULL ? forceField->sample(currentParticle->position.x, currentParticle->position.y) : Vector2fZero;
+            
+            radial = Vector2fZero;
+            Vector2f diff = Vector2fSub(currentParticle->startPos, Vector2fZero);
+            
+            currentParticle->position = Vector2fSub(currentParticle->position, diff);
+            
+            if (currentParticle->position.x || currentParticle->position.y)
+                radial = Vector2fNormalize(currentParticle->position);
+            
+            tangential.x = radial.x;
+            tangential.y = radial.y;
+            radial = Vector2fMultiply(radial, currentParticle->radialAcceleration);
+            
+            GLfloat newy = tangential.x;
+            tangential.x = -tangential.y;
+            tangential.y = newy;
+            tangential = Vector2fMultiply(tangential, currentParticle->tangentialAcceleration);
+            
+			tmp = Vector2fAdd( Vector2fAdd( Vector2fAdd(radial, tangential), gravity), field);
+            tmp = Vector2fMultiply(tmp, aDelta);
+			currentParticle->direction = Vector2fAdd(currentParticle->direction, tmp);
+			tmp = Vector2fMultiply(currentParticle->direction, aDelta);
+			currentParticle->position = Vector2fAdd(currentParticle->position, tmp);
+            currentParticle->position = Vector2fAdd(currentParticle->position, diff);
+		}
+		
+		// Update the particles color
+		currentParticle->color.r += currentParticle->deltaColor.r * deltaScale;
+		currentParticle->color.g += currentParticle->deltaColor.g * deltaScale;
+		currentParticle->color.b += currentParticle->deltaColor.b * deltaScale;
+		currentParticle->color.a += currentParticle->deltaColor.a * deltaScale;
 		
-		// Get the particle for the current particle index
-		Particle *currentParticle = &particles[particleIndex];
-        
-        // FIX 1
-        // Reduce the life span of the particle
-        currentParticle->timeToLive -= aDelta;
+		// Update the particles size
+		currentParticle->particleSize += currentParticle->particleSizeDelta * deltaScale;
+	}
+}
+
+void ofxParticleEmitter::integrateSlice( GLfloat aDelta )
+{
+	// Integrate one contiguous slice of the particles per frame, so each particle is
+	// integrated about every updateInterval frames.  Compaction and sorting move
+	// particles between slices, so every particle carries the time it has not been
+	// integrated for rather than relying on its index.  The collider sweeps from
+	// prevPosition, which covers the whole accumulated move of an integrated particle
+	const int interval = MAX( 1, updateInterval );
+	const int slice = slicePhase % interval;
+	const int sliceBegin = (int)( (int64_t)particleCount * slice / interval );
+	const int sliceEnd = (int)( (int64_t)particleCount * ( slice + 1 ) / interval );
+	slicePhase = ( slice + 1 ) % interval;
+	
+	for ( int index = 0; index < particleCount; index++ )
+	{
+		Particle* p = &particles[index];
+		p->pendingTime += aDelta;
 		
-		// If the current particle is alive then update it
-		if(currentParticle->timeToLive > 0) {
+		if ( index >= sliceBegin && index < sliceEnd )
+		{
+			// Per particle deltas are per update(), so scale them by the frames covered
+			GLfloat elapsed = p->pendingTime;
+			p->pendingTime = 0.0f;
+			integrateParticle( p, elapsed, aDelta > 0.0f ? elapsed / aDelta : 1.0f, false );
+		}
+		else
+		{
+			// The particle did not move this frame, give the collider an empty path
+			// instead of the one from its last integration
+			p->prevPosition = p->position;
 			
-			// If maxRadius is greater than 0 then the particles are going to spin otherwise
-			// they are effected by speed and gravity
-			if (emitterType == kParticleTypeRadial) {
-				
-                // FIX 2
-                // Update the angle of the particle from the sourcePosition and the radius.  This is only
-				// done of the particles are rotating
-				currentParticle->angle += currentParticle->degreesPerSecond * aDelta;
-				currentParticle->radius -= currentParticle->radiusDelta;
-                
-				Vector2f tmp;
-				tmp.x = sourcePosition.x - cosf(currentParticle->angle) * currentParticle->radius;
-				tmp.y = sourcePosition.y - sinf(currentParticle->angle) * currentParticle->radius;
-				currentParticle->position = tmp;
-				
-				if (currentParticle->radius < minRadius)
-					currentParticle->timeToLive = 0;
-			} else {
-				Vector2f tmp, radial, tangential;
-                
-                radial = Vector2fZero;
-                Vector2f diff = Vector2fSub(currentParticle->startPos, Vector2fZero);
-                
-                currentParticle->position = Vector2fSub(currentParticle->position, diff);
-                
-                if (currentParticle->position.x || currentParticle->position.y)
-                    radial = Vector2fNormalize(currentParticle->position);
-                
-                tangential.x = radial.x;
-                tangential.y = radial.y;
-                radial = Vector2fMultiply(radial, currentParticle->radialAcceleration);
-                
-                GLfloat newy = tangential.x;
-                tangential.x = -tangential.y;
-                tangential.y = newy;
-                tangential = Vector2fMultiply(tangential, currentParticle->tangentialAcceleration);
-                
-				tmp = Vector2fAdd( Vector2fAdd(radial, tangential), gravity);
-                tmp = Vector2fMultiply(tmp, aDelta);
-				currentParticle->direction = Vector2fAdd(currentParticle->direction, tmp);
-				tmp = Vector2fMultiply(currentParticle->direction, aDelta);
-				currentParticle->position = Vector2fAdd(currentParticle->position, tmp);
-                currentParticle->position = Vector2fAdd(currentParticle->position, diff);
+			// Still retire particles on time when they are outside the slice
+			if ( p->pendingTime >= p->timeToLive )
+				p->timeToLive = 0;
+		}
+	}
+	
+	// Going back to an interval of 1 takes one more pass to catch up every particle
+	slicePending = interval > 1;
+}
+
+void ofxParticleEmitter::catchUpSlices()
+{
+	// Fixed steps never look at pendingTime, so hand every particle the time it still
+	// holds from slicing before they take over.  Per particle deltas are per
+	// MAXIMUM_UPDATE_RATE steps in that mode, scale them the same way
+	for ( int index = 0; index < particleCount; index++ )
+	{
+		Particle* p = &particles[index];
+		if ( p->pendingTime <= 0.0f ) continue;
+		
+		GLfloat elapsed = p->pendingTime;
+		p->pendingTime = 0.0f;
+		integrateParticle( p, elapsed, elapsed * MAXIMUM_UPDATE_RATE, false );
+	}
+	slicePending = false;
+	
+	// Retire what ran out of life and collide the catch up moves
+	finishStep( 0.0f );
+}
+
+void ofxParticleEmitter::finishStep( GLfloat aDelta )
+{
+	// Pack the particles that ran out of life during integration
+	removeDeadParticles();
+	
+	// Deflect, kill and trigger against the scene geometry now that positions are final
+	if ( collider != NULL && particleCount > 0 )
+	{
+		int killed = collider->process( particles, particleCount, aDelta, emitterType == kParticleTypeGravity );
+		
+		if ( eventTypes & PARTICLE_EVENT_MASK( kParticleEventCollision ) )
+		{
+			const vector<int>& hits = collider->getCollisions();
+			for ( size_t i = 0; i < hits.size(); i++ )
+				dispatchEvent( kParticleEventCollision, &particles[hits[i]] );
+		}
+		
+		if ( killed > 0 )
+			removeDeadParticles();
+	}
+}
+
+void ofxParticleEmitter::removeDeadParticles()
+{
+	// Sorted emitters keep the survivors in order, so with births appended at the end
+	// the next sort is at most a merge of two runs
+	if ( sortMode != kParticleSortNone )
+	{
+		int live = 0;
+		for ( particleIndex = 0; particleIndex < particleCount; particleIndex++ )
+		{
+			if ( particles[particleIndex].timeToLive <= 0 )
+			{
+				recordEvent( kParticleEventDeath, &particles[particleIndex] );
+				continue;
 			}
+			if ( live != particleIndex )
+				particles[live] = particles[particleIndex];
+			live++;
+		}
+		particleCount = live;
+		return;
+	}
+	
+	// As a particle is not alive anymore replace it with the last active particle 
+	// in the array and reduce the count of particles by one.  This causes all active particles
+	// to be packed together at the start of the array
+	particleIndex = 0;
+	while ( particleIndex < particleCount )
+	{
+		if ( particles[particleIndex].timeToLive > 0 )
+		{
+			particleIndex++;
+			continue;
+		}
+		
+		recordEvent( kParticleEventDeath, &particles[particleIndex] );
+		if ( particleIndex != particleCount - 1 )
+			particles[particleIndex] = particles[particleCount - 1];
+		particleCount--;
+	}
+}
+
+void ofxParticleEmitter::sortParticles()
+{
+	if ( sortMode == kParticleSortNone || particleCount < 2 || blendFuncDestination == GL_ONE )
+		return;
+	
+	if ( sortScratch == NULL )
+	{
+		sortScratch = (Particle*)malloc( sizeof( Particle ) * maxParticles );
+		assert( sortScratch );
+	}
+	
+	uint32_t* keys = sorter.beginKeys( particleCount );
+	for ( int i = 0; i < particleCount; i++ )
+	{
+		const Particle* p = &particles[i];
+		
+		GLfloat key;
+		if ( sortMode == kParticleSortByDepth ) {
+			key = Vector2fDot( p->position, sortAxis );
+		} else {
+			GLfloat age = ( p->inverseLifespan > 0 ? 1.0f / p->inverseLifespan : 0.0f ) - ( p->timeToLive - p->pendingTime );
+			key = sortMode == kParticleSortOldestFirst ? -age : age;
+		}
+		keys[i] = particleSortKey( key );
+	}
+	
+	// Nothing to do when last frame's order still holds
+	const int* order = sorter.sort();
+	if ( order == NULL ) return;
+	
+	for ( int i = 0; i < particleCount; i++ )
+		sortScratch[i] = particles[order[i]];
+	std::swap( particles, sortScratch );
+}
+
+void ofxParticleEmitter::setSortMode( int mode )
+{
+	sync();
+	sortMode = mode;
+}
+
+void ofxParticleEmitter::finishFrame( GLfloat alpha )
+{
+	// The worker's vertices are published by swapping buffers, so they are needed now.
+	// Otherwise leave them until something asks for them, emitters that are culled or
+	// only exported with writeVertices() never fill their own array
+	fillAlpha = alpha;
+	if ( threaded )
+	{
+		fillVertices( vertices, particleCount, alpha );
+		filledCount = particleCount;
+		verticesDirty = false;
+	}
+	else
+	{
+		verticesDirty = true;
+	}
+}
+
+const PointSprite* ofxParticleEmitter::getVertices() const
+{
+	if ( threaded )
+		return frontVertices;
+	
+	if ( verticesDirty )
+	{
+		fillVertices( vertices, particleCount, fillAlpha );
+		verticesDirty = false;
+	}
+	return vertices;
+}
+
+int ofxParticleEmitter::writeVertices( PointSprite* out, int capacity ) const
+{
+	if ( out == NULL || capacity <= 0 ) return 0;
+	
+	// The worker may be writing the particles, copy the finished frame instead
+	if ( threaded )
+	{
+		int count = MIN( frontCount, capacity );
+		if ( count > 0 )
+			memcpy( out, frontVertices, sizeof( PointSprite ) * count );
+		return count;
+	}
+	
+	int count = MIN( (int)particleCount, capacity );
+	if ( !verticesDirty )
+	{
+		if ( count > 0 )
+			memcpy( out, vertices, sizeof( PointSprite ) * count );
+		return count;
+	}
+	
+	fillVertices( out, count, fillAlpha );
+	return count;
+}
+
+void ofxParticleEmitter::fillVertices( PointSprite* out, int count, GLfloat alpha ) const
+{
+#ifdef PARTICLE_USE_SSE
+	// Each vertex goes out as two stores, x, y and size followed by the color, which
+	// overwrites the 4th lane of the first.  The position is loaded together with the
+	// field after it and the size shuffled in behind it, see the Particle layout
+	const __m128 zero = _mm_setzero_ps();
+	if ( alpha >= 1.0f )
+	{
+		for ( int i = 0; i < count; i++ )
+		{
+			const Particle* p = &particles[i];
 			
-			// Update the particles color
-			currentParticle->color.r += currentParticle->deltaColor.r;
-			currentParticle->color.g += currentParticle->deltaColor.g;
-			currentParticle->color.b += currentParticle->deltaColor.b;
-			currentParticle->color.a += currentParticle->deltaColor.a;
+			__m128 size = _mm_max_ss( _mm_load_ss( &p->particleSize ), zero );
+			_mm_storeu_ps( &out[i].x, _mm_shuffle_ps( _mm_loadu_ps( &p->position.x ), size, _MM_SHUFFLE( 1, 0, 1, 0 ) ) );
+			_mm_storeu_ps( &out[i].color.r, _mm_loadu_ps( &p->color.r ) );
+		}
+	}
+	else
+	{
+		const __m128 t = _mm_set1_ps( alpha );
+		for ( int i = 0; i < count; i++ )
+		{
+			const Particle* p = &particles[i];
 			
-			// Place the position of the current particle into the vertices array
-			vertices[particleIndex].x = currentParticle->position.x;
-			vertices[particleIndex].y = currentParticle->position.y;
+			// Lanes are x, y, size, unused
+			__m128 from = _mm_shuffle_ps( _mm_loadu_ps( &p->prevPosition.x ), _mm_load_ss( &p->prevParticleSize ), _MM_SHUFFLE( 1, 0, 1, 0 ) );
+			__m128 to = _mm_shuffle_ps( _mm_loadu_ps( &p->position.x ), _mm_load_ss( &p->particleSize ), _MM_SHUFFLE( 1, 0, 1, 0 ) );
+			__m128 blend = _mm_add_ps( from, _mm_mul_ps( _mm_sub_ps( to, from ), t ) );
+			_mm_storeu_ps( &out[i].x, _mm_shuffle_ps( blend, _mm_max_ps( blend, zero ), _MM_SHUFFLE( 3, 2, 1, 0 ) ) );
 			
-			// Place the size of the current particle in the size array
-			currentParticle->particleSize += currentParticle->particleSizeDelta;
-			vertices[particleIndex].size = MAX(0, currentParticle->particleSize);
+			from = _mm_loadu_ps( &p->prevColor.r );
+			to = _mm_loadu_ps( &p->color.r );
+			_mm_storeu_ps( &out[i].color.r, _mm_add_ps( from, _mm_mul_ps( _mm_sub_ps( to, from ), t ) ) );
+		}
+	}
+#else
+	if ( alpha >= 1.0f )
+	{
+		for ( int i = 0; i < count; i++ )
+		{
+			const Particle* p = &particles[i];
 			
-			// Place the color of the current particle into the color array
-			vertices[particleIndex].color = currentParticle->color;
+			// Place the position, size and color of the current particle into the vertices array
+			out[i].x = p->position.x;
+			out[i].y = p->position.y;
+			out[i].size = MAX(0, p->particleSize);
+			out[i].color = p->color;
+		}
+	}
+	else
+	{
+		// Blend between the last two simulation steps using how far we are into the next one
+		for ( int i = 0; i < count; i++ )
+		{
+			const Particle* p = &particles[i];
 			
-			// Update the particle counter
-			particleIndex++;
-		} else {
+			out[i].x = p->prevPosition.x + (p->position.x - p->prevPosition.x) * alpha;
+			out[i].y = p->prevPosition.y + (p->position.y - p->prevPosition.y) * alpha;
+			out[i].size = MAX(0, p->prevParticleSize + (p->particleSize - p->prevParticleSize) * alpha);
+			out[i].color.r = p->prevColor.r + (p->color.r - p->prevColor.r) * alpha;
+			out[i].color.g = p->prevColor.g + (p->color.g - p->prevColor.g) * alpha;
+			out[i].color.b = p->prevColor.b + (p->color.b - p->prevColor.b) * alpha;
+			out[i].color.a = p->prevColor.a + (p->color.a - p->prevColor.a) * alpha;
+		}
+	}
+#endif
+	
+	if ( colorGradient.isEnabled() || alphaCurve.isEnabled() || sizeCurve.isEnabled() )
+		applyLifetimeCurves( out, count, alpha );
+}
+
+void ofxParticleEmitter::applyLifetimeCurves( PointSprite* out, int count, GLfloat alpha ) const
+{
+	// When interpolating the vertices show a point (1 - alpha) steps before the current state
+	GLfloat timeOffset = alpha < 1.0f ? (1.0f - alpha) * fixedTimestep : 0.0f;
+	
+	for ( int i = 0; i < count; i++ )
+	{
+		const Particle* p = &particles[i];
+		GLfloat age = 1.0f - (p->timeToLive - p->pendingTime + timeOffset) * p->inverseLifespan;
+		
+		if ( colorGradient.isEnabled() )
+			out[i].color = colorGradient.sample(age);
+		if ( alphaCurve.isEnabled() )
+			out[i].color.a *= alphaCurve.sample(age);
+		if ( sizeCurve.isEnabled() )
+			out[i].size = MAX(0, p->baseSize * sizeCurve.sample(age));
+	}
+}
+
+void ofxParticleEmitter::setFixedUpdateRate( GLfloat updatesPerSecond )
+{
+	sync();
+	
+	fixedTimestep = updatesPerSecond > 0.0f ? 1.0f / updatesPerSecond : 0.0f;
+	fixedAccumulator = 0.0f;
+	
+	// Particles left behind by time slicing would otherwise keep their time forever,
+	// living longer and drawing younger than they are
+	if ( fixedTimestep > 0.0f && slicePending )
+		catchUpSlices();
+}
+
+void ofxParticleEmitter::setUpdateInterval( int interval )
+{
+	sync();
+	updateInterval = MAX( 1, interval );
+}
+
+void ofxParticleEmitter::setUpdatePriority( GLfloat priority, int maxInterval )
+{
+	// Full rate at priority 1, maxInterval at priority 0
+	priority = MIN( 1.0f, MAX( 0.0f, priority ) );
+	setUpdateInterval( (int)( 1.0f + ( 1.0f - priority ) * ( MAX( 1, maxInterval ) - 1 ) + 0.5f ) );
+}
+
+void ofxParticleEmitter::setUpdateDistance( GLfloat distance, GLfloat nearDistance, GLfloat farDistance, int maxInterval )
+{
+	GLfloat priority = farDistance > nearDistance ? 1.0f - ( distance - nearDistance ) / ( farDistance - nearDistance ) : ( distance <= nearDistance ? 1.0f : 0.0f );
+	setUpdatePriority( priority, maxInterval );
+}
+
+GLfloat ofxParticleEmitter::getFixedUpdateRate() const
+{
+	return fixedTimestep > 0.0f ? 1.0f / fixedTimestep : 0.0f;
+}
+
+// ------------------------------------------------------------------------
+// Events
+// ------------------------------------------------------------------------
+
+void ofxParticleEmitter::enableEvents( int mask, int capacity )
+{
+	sync();
+	
+	if ( mask != 0 && !eventRing.isAllocated() )
+		eventRing.allocate( capacity );
+	
+	eventMask = mask;
+	eventTypes = eventMask;
+	for ( size_t i = 0; i < subEmitters.size(); i++ )
+		eventTypes |= PARTICLE_EVENT_MASK( subEmitters[i].eventType );
+}
+
+void ofxParticleEmitter::addSubEmitter( int eventType, ofxParticleEmitter* child, int particlesPerEvent, bool inheritColor )
+{
+	if ( child == NULL || child == this ) return;
+	
+	sync();
+	
+	SubEmitterBinding binding;
+	binding.eventType = eventType;
+	binding.child = child;
+	binding.particlesPerEvent = MAX( 1, particlesPerEvent );
+	binding.inheritColor = inheritColor;
+	binding.pendingCount = 0;
+	binding.pendingCapacity = 0;
+	binding.pending = NULL;
+	
+	subEmitters.push_back( binding );
+	eventTypes |= PARTICLE_EVENT_MASK( eventType );
+	
+	reserveSubEmitters();
+}
+
+void ofxParticleEmitter::reserveSubEmitters()
+{
+	// The child may be loaded, or reloaded with a larger pool, after the binding is
+	// made, so the buffers follow its size.  Called before each simulation, events are
+	// recorded from the worker threads where nothing may be allocated.  More pending
+	// events than the child could ever hold would only be thrown away
+	for ( size_t i = 0; i < subEmitters.size(); i++ )
+	{
+		SubEmitterBinding& b = subEmitters[i];
+		int capacity = MAX( 1, b.child->maxParticles / b.particlesPerEvent );
+		if ( capacity <= b.pendingCapacity ) continue;
+		
+		b.pending = (ParticleEvent*)realloc( b.pending, sizeof( ParticleEvent ) * capacity );
+		assert( b.pending );
+		b.pendingCapacity = capacity;
+	}
+}
+
+void ofxParticleEmitter::clearSubEmitters()
+{
+	sync();
+	
+	for ( size_t i = 0; i < subEmitters.size(); i++ )
+		free( subEmitters[i].pending );
+	subEmitters.clear();
+	
+	eventTypes = eventMask;
+}
+
+void ofxParticleEmitter::flushSubEmitters()
+{
+	for ( size_t i = 0; i < subEmitters.size(); i++ )
+	{
+		SubEmitterBinding& b = subEmitters[i];
+		if ( b.pendingCount == 0 ) continue;
+		
+		b.child->spawnBatch( b.pending, b.pendingCount, b.particlesPerEvent, b.inheritColor );
+		b.pendingCount = 0;
+	}
+}
+
+void ofxParticleEmitter::dispatchEvent( int type, const Particle* particle )
+{
+	ParticleEvent event;
+	event.type = type;
+	event.x = particle->position.x;
+	event.y = particle->position.y;
+	event.vx = particle->direction.x;
+	event.vy = particle->direction.y;
+	event.color = particle->color;
+	
+	if ( eventMask & PARTICLE_EVENT_MASK( type ) )
+		eventRing.push( event );
+	
+	for ( size_t i = 0; i < subEmitters.size(); i++ )
+	{
+		SubEmitterBinding& b = subEmitters[i];
+		if ( b.eventType == type && b.pendingCount < b.pendingCapacity )
+			b.pending[b.pendingCount++] = event;
+	}
+}
+
+int ofxParticleEmitter::spawnBatch( const ParticleEvent* batch, int count, int particlesPerEvent, bool inheritColor )
+{
+	if ( particles == NULL ) return 0;
+	
+	// The worker may still be integrating this emitter
+	sync();
+	
+	int spawned = 0;
+	verticesDirty = !threaded;
+	for ( int i = 0; i < count; i++ )
+	{
+		for ( int j = 0; j < particlesPerEvent; j++ )
+		{
+			if ( particleCount == maxParticles )
+				return spawned;
+			
+			Particle *particle = &particles[particleCount];
+			initParticle( particle );
 			
-			// As the particle is not alive anymore replace it with the last active particle 
-			// in the array and reduce the count of particles by one.  This causes all active particles
-			// to be packed together at the start of the array so that a particle which has run out of
-			// life will only drop into this clause once
-			if(particleIndex != particleCount - 1)
-				particles[particleIndex] = particles[particleCount - 1];
-			particleCount--;
+			// Move the particle, along with its position variance, to the event position
+			particle->position.x += batch[i].x - sourcePosition.x;
+			particle->position.y += batch[i].y - sourcePosition.y;
+			particle->startPos.x = batch[i].x;
+			particle->startPos.y = batch[i].y;
+			particle->prevPosition = particle->position;
+			
+			if ( inheritColor )
+				particle->color = particle->prevColor = batch[i].color;
+			
+			particleCount++;
+			spawned++;
+			
+			recordEvent( kParticleEventBirth, particle );
+		}
+	}
+	
+	return spawned;
+}
+
+// ------------------------------------------------------------------------
+// Threading
+// ------------------------------------------------------------------------
+
+void ofxParticleEmitter::setThreaded( bool enable )
+{
+	if ( enable == threaded ) return;
+	
+	if ( enable )
+	{
+		if ( vertices != NULL && frontVertices == NULL )
+		{
+			frontVertices = (PointSprite*)malloc( sizeof( PointSprite ) * maxParticles );
+			assert( frontVertices );
 		}
+		
+		// Start with the current frame visible so there is no blank frame on the switch
+		if ( vertices != NULL )
+			memcpy( frontVertices, getVertices(), sizeof( PointSprite ) * particleCount );
+		frontCount = filledCount = particleCount;
+		frontActive = active;
+		
+		workPending = workerExit = false;
+		threaded = true;
+		worker = new std::thread( &ofxParticleEmitter::threadedFunction, this );
 	}
+	else
+	{
+		{
+			std::unique_lock<std::mutex> lock( workerMutex );
+			workerExit = true;
+			workerCondition.notify_all();
+		}
+		worker->join();
+		delete worker;
+		worker = NULL;
+		threaded = false;
+		
+		// vertices holds an older frame after the last swap, regenerate it on demand
+		verticesDirty = true;
+	}
+}
 
-	lastUpdateMillis = ofGetElapsedTimeMillis();
+void ofxParticleEmitter::sync()
+{
+	if ( !threaded ) return;
+	
+	std::unique_lock<std::mutex> lock( workerMutex );
+	while ( workPending )
+		workerCondition.wait( lock );
+}
+
+void ofxParticleEmitter::threadedFunction()
+{
+	std::unique_lock<std::mutex> lock( workerMutex );
+	
+	while ( true )
+	{
+		while ( !workPending && !workerExit )
+			workerCondition.wait( lock );
+		
+		// Pending work is finished before exiting so sync() never waits forever
+		if ( !workPending && workerExit )
+			break;
+		
+		GLfloat aDelta = pendingDelta;
+		lock.unlock();
+		simulate( aDelta );
+		lock.lock();
+		
+		workPending = false;
+		workerCondition.notify_all();
+	}
 }
 
 // ------------------------------------------------------------------------
@@ -445,33 +1191,43 @@ void ofxParticleEmitter::update()
 
 void ofxParticleEmitter::draw(int x /* = 0 */, int y /* = 0 */)
 {
-	if ( !active ) return;
+	// active is written by the worker while threaded, use the state published by update()
+	if ( !( threaded ? frontActive : active ) ) return;
+	
+	drawVertices( getVertices(), getVertexCount(), x, y );
+}
+
+void ofxParticleEmitter::drawVertices( const PointSprite* verts, int count, int x, int y ) const
+{
+	if ( verts == NULL || count <= 0 ) return;
 	
 	glPushMatrix();
 	glTranslatef( x, y, 0.0f );
 	
 #ifdef TARGET_OF_IPHONE
 	
-	drawPointsOES();
+	drawPointsOES( verts, count );
 	
 #else
 	
-	drawTextures();
-	//drawPoints();
+	drawTextures( verts, count );
+	//drawPoints( verts, count );
 	
 #endif
 	
 	glPopMatrix();
 }
 
-void ofxParticleEmitter::drawTextures()
+void ofxParticleEmitter::drawTextures( const PointSprite* verts, int count ) const
 {
+	if ( texture == NULL ) return;
+	
 	glEnable(GL_BLEND);
 	glBlendFunc(blendFuncSource, blendFuncDestination);
 	
-	for( int i = 0; i < particleCount; i++ )
+	for( int i = 0; i < count; i++ )
 	{
-		PointSprite* ps = &vertices[i];
+		const PointSprite* ps = &verts[i];
 		ofSetColor( ps->color.r*255.0f, ps->color.g*255.0f, 
 				   ps->color.b*255.0f, ps->color.a*255.0f );
 		texture->draw( ps->x, ps->y, ps->size, ps->size );
@@ -483,7 +1239,7 @@ void ofxParticleEmitter::drawTextures()
 // this doesn't yet work, it is an attempt to port over the point sprite logic
 // from opengles. It draws the point sprites but it doesn't replace the point
 // size or color values. I left it here in case anyone wants to fix it :)
-void ofxParticleEmitter::drawPoints()
+void ofxParticleEmitter::drawPoints( const PointSprite* verts, int count ) const
 {
 	// Disable the texture coord array so that texture information is not copied over when rendering
 	// the point sprites.
@@ -491,7 +1247,7 @@ void ofxParticleEmitter::drawPoints()
 	
 	// Bind to the verticesID VBO and popuate it with the necessary vertex & color informaiton
 	glBindBuffer(GL_ARRAY_BUFFER, verticesID);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(PointSprite) * maxParticles, vertices, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(PointSprite) * count, verts, GL_DYNAMIC_DRAW);
 	
 	// Configure the vertex pointer which will use the currently bound VBO for its data
 	glVertexPointer(2, GL_FLOAT, sizeof(PointSprite), 0);
@@ -525,7 +1281,7 @@ void ofxParticleEmitter::drawPoints()
 	
 	// Now that all of the VBOs have been used to configure the vertices, pointer size and color
 	// use glDrawArrays to draw the points
-	glDrawArrays(GL_POINTS, 0, particleIndex);
+	glDrawArrays(GL_POINTS, 0, count);
 	
 	// Unbind the current VBO
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -546,7 +1302,7 @@ void ofxParticleEmitter::drawPoints()
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 }
 
-void ofxParticleEmitter::drawPointsOES()
+void ofxParticleEmitter::drawPointsOES( const PointSprite* verts, int count ) const
 {
 #ifdef TARGET_OF_IPHONE
 	
@@ -556,7 +1312,7 @@ void ofxParticleEmitter::drawPointsOES()
 	
 	// Bind to the verticesID VBO and popuate it with the necessary vertex & color informaiton
 	glBindBuffer(GL_ARRAY_BUFFER, verticesID);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(PointSprite) * maxParticles, vertices, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(PointSprite) * count, verts, GL_DYNAMIC_DRAW);
 	
 	// Configure the vertex pointer which will use the currently bound VBO for its data
 	glVertexPointer(2, GL_FLOAT, sizeof(PointSprite), 0);
@@ -584,7 +1340,7 @@ void ofxParticleEmitter::drawPointsOES()
 	
 	// Now that all of the VBOs have been used to configure the vertices, pointer size and color
 	// use glDrawArrays to draw the points
-	glDrawArrays(GL_POINTS, 0, particleIndex);
+	glDrawArrays(GL_POINTS, 0, count);
 	
 	// Unbind the current VBO
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -600,6 +1356,9 @@ void ofxParticleEmitter::drawPointsOES()
 	// its on
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	
+#else
+	(void)verts;
+	(void)count;
 #endif
 }
 
@@ -26,6 +26,14 @@
 
 #include "ofMain.h"
 #include "ofxXmlSettings.h"
+#include "ofxParticleEvents.h"
+#include "ofxParticleCurve.h"
+#include "ofxParticleShape.h"
+#include "ofxParticleSort.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // ------------------------------------------------------------------------
 // Structures
@@ -52,6 +60,15 @@ enum kParticleTypes
 	kParticleTypeRadial
 };
 
+// Draw order of the particles in the vertex output
+enum kParticleSortModes
+{
+	kParticleSortNone,
+	kParticleSortOldestFirst,	// Newest particles drawn on top
+	kParticleSortNewestFirst,
+	kParticleSortByDepth		// Ascending position along the sort axis
+};
+
 // Structure that holds the location and size for each point sprite
 typedef struct 
 {
@@ -61,7 +78,9 @@ typedef struct
 	ofFloatColor color;
 } PointSprite;
 
-// Structure used to hold particle specific information
+// Structure used to hold particle specific information.  The vertex fill loads the
+// 16 bytes starting at position and at prevPosition as one vector each, so both need
+// at least two more floats behind them
 typedef struct 
 {
 	Vector2f	position;
@@ -78,17 +97,56 @@ typedef struct
 	GLfloat		particleSize;
 	GLfloat		particleSizeDelta;
 	GLfloat		timeToLive;
+	GLfloat		inverseLifespan;	// 1 / initial timeToLive, turns timeToLive into a normalized age
+	GLfloat		baseSize;			// Size at birth, scaled by the size curve when there is one
+	
+	// State before the last integration.  The position is always kept, it is the start
+	// of the path the collider tests; color and size only when interpolating fixed steps
+	Vector2f		prevPosition;
+	ofFloatColor	prevColor;
+	GLfloat			prevParticleSize;
+	
+	// Time passed since the particle was last integrated, only used when time slicing
+	GLfloat			pendingTime;
 } Particle;
 
+// Small xorshift generator.  Every emitter owns one so emitters can be updated on
+// different threads without sharing random state (ofRandom is not thread safe)
+class ofxParticleRandom
+{
+	
+public:
+	
+	ofxParticleRandom( uint32_t seed = 1 ) { setSeed( seed ); }
+	
+	void setSeed( uint32_t seed ) { state = seed != 0 ? seed : 0x9e3779b9u; }
+	
+	inline uint32_t next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	
+	// 24 random bits scaled to [0, 1)
+	inline float nextUnit() { return ( next() >> 8 ) * ( 1.0f / 16777216.0f ); }
+	inline float nextSigned() { return nextUnit() * 2.0f - 1.0f; }
+	
+protected:
+	
+	uint32_t state;
+};
+
 // ------------------------------------------------------------------------
 // Macros
 // ------------------------------------------------------------------------
 
-// Macro which returns a random value between -1 and 1
-#define RANDOM_MINUS_1_TO_1() (ofRandom( -1.0f, 1.0f ))
+// Macro which returns a random value between -1 and 1 from the emitter's own generator
+#define RANDOM_MINUS_1_TO_1() (rng.nextSigned())
 
-// Macro which returns a random number between 0 and 1
-#define RANDOM_0_TO_1() (ofRandom( 0.0f, 1.0f ))
+// Macro which returns a random number between 0 and 1 from the emitter's own generator
+#define RANDOM_0_TO_1() (rng.nextUnit())
 
 // Macro which converts degrees into radians
 #define DEGREES_TO_RADIANS(__ANGLE__) ((__ANGLE__) / 180.0 * PI)
@@ -155,6 +213,24 @@ static inline Vector2f Vector2fNormalize(Vector2f v) {
 }
 
 #define MAXIMUM_UPDATE_RATE 90.0f	// The maximum number of updates that occur per frame
+#define MAXIMUM_FIXED_STEPS 8		// The most fixed rate steps taken to catch up in a single update
+
+class ofxParticleForceField;
+class ofxParticleCollider;
+class ofxParticleEmitter;
+
+// Spawns particles in a child emitter for every event of one type in a parent emitter.
+// Events are queued into a buffer sized from the child's maxParticles before every
+// update and handed to the child in one batch once the parent's frame is done
+typedef struct
+{
+	int					eventType;
+	ofxParticleEmitter*	child;
+	int					particlesPerEvent;
+	bool				inheritColor;
+	ParticleEvent*		pending;
+	int					pendingCount, pendingCapacity;
+} SubEmitterBinding;
 
 // ------------------------------------------------------------------------
 // ofxParticleEmitter
@@ -172,6 +248,74 @@ public:
 	void	update();
 	void	draw( int x = 0, int y = 0 );
 	void	exit();
+	
+	// Draws an externally supplied vertex array (e.g. a recorded frame) using this
+	// emitter's texture and blend settings, without touching the simulation
+	void	drawVertices( const PointSprite* verts, int count, int x = 0, int y = 0 ) const;
+	
+	// Vertices of the most recently completed frame, i.e. the ones draw() uses.  Unless
+	// threaded they are only generated on the first call after update(), so emitters
+	// that are not drawn skip vertex output
+	const PointSprite*	getVertices() const;
+	int					getVertexCount() const { return threaded ? frontCount : particleCount; }
+	
+	// Writes up to capacity vertices of the current frame straight into out, e.g. a
+	// mapped buffer or ofxParticleSharedMemoryWriter::beginFrame(), without going through
+	// the emitter's own vertex array.  Returns the number written
+	int		writeVertices( PointSprite* out, int capacity ) const;
+	
+	// When threaded, update() swaps the finished frame into a front vertex buffer and
+	// simulates the next frame on a worker thread while the current one is drawn.  The
+	// worker runs from update() until the next update() or sync(), so call sync() before
+	// changing any public emitter member while threaded; the setter methods sync themselves
+	void	setThreaded( bool threaded );
+	bool	isThreaded() const { return threaded; }
+	void	sync();
+	
+	// Simulate at a fixed number of steps per second rather than once per update().
+	// Rendering interpolates position, color and size between the last two steps.
+	// Pass 0 to go back to stepping once per update()
+	void	setFixedUpdateRate( GLfloat updatesPerSecond );
+	GLfloat	getFixedUpdateRate() const;
+	
+	// Integrate only one of every interval slices of the particles per update(), each
+	// with the time it has accumulated, e.g. for background emitters.  Particles are
+	// still emitted and retired every frame.  Ignored when a fixed update rate is set
+	void	setUpdateInterval( int interval );
+	int		getUpdateInterval() const { return updateInterval; }
+	
+	// Derive the interval from a priority in [0, 1], full rate at 1 and maxInterval at
+	// 0, or from the distance to the viewer between nearDistance and farDistance
+	void	setUpdatePriority( GLfloat priority, int maxInterval = 4 );
+	void	setUpdateDistance( GLfloat distance, GLfloat nearDistance, GLfloat farDistance, int maxInterval = 4 );
+	
+	// Optional force field sampled by gravity type particles in addition to gravity.
+	// The field is not owned by the emitter and may be shared between emitters
+	void					setForceField( ofxParticleForceField* field ) { sync(); forceField = field; }
+	ofxParticleForceField*	getForceField() const { return forceField; }
+	
+	// Optional collision stage run after integration each step, not owned by the emitter
+	void					setCollider( ofxParticleCollider* collider ) { sync(); this->collider = collider; }
+	ofxParticleCollider*	getCollider() const { return collider; }
+	
+	// Record the event types in mask (PARTICLE_EVENT_MASK bits) into a ring that game
+	// code drains with getEvents().pop().  Recording is off by default
+	void					enableEvents( int mask, int capacity = 4096 );
+	ofxParticleEventRing&	getEvents() { return eventRing; }
+	
+	// Sub-emitters are not owned and may be bound before they are loaded.  Pending
+	// events are handed over by update()
+	void	addSubEmitter( int eventType, ofxParticleEmitter* child, int particlesPerEvent = 1, bool inheritColor = false );
+	void	clearSubEmitters();
+	void	flushSubEmitters();
+	
+	// Spawns particlesPerEvent particles at each event position, stopping when the pool
+	// is full.  Returns the number of particles spawned
+	int		spawnBatch( const ParticleEvent* batch, int count, int particlesPerEvent = 1, bool inheritColor = false );
+	
+	// Seeds the emitter's random generator, e.g. for reproducible captures.  Each emitter
+	// starts from a seed derived from its address
+	void	setRandomSeed( uint32_t seed ) { sync(); rng.setSeed( seed ); }
 
 	int				emitterType;
 	Vector2f		sourcePosition, sourcePositionVariance;			
@@ -198,21 +342,74 @@ public:
 	GLfloat			minRadius;						// Radius from source below which a particle dies
 	GLfloat			rotatePerSecond;				// Number of degrees to rotate a particle around the source position per second
 	GLfloat			rotatePerSecondVariance;		// Variance in degrees for rotatePerSecond
+	
+	// Optional lifetime curves read from the config, sampled by normalized particle age.
+	// A color gradient replaces the start/finish color, the alpha curve multiplies the
+	// resulting alpha and the size curve scales each particle's start size.  The emission
+	// rate curve scales emission over the duration (or its period attribute if given)
+	ofxParticleGradient	colorGradient;
+	ofxParticleCurve	alphaCurve;
+	ofxParticleCurve	sizeCurve;
+	ofxParticleCurve	emissionRateCurve;
+	
+	// Where particles are born relative to sourcePosition.  The default box shape uses
+	// sourcePositionVariance, the other shapes replace it
+	ofxParticleEmitterShape	shape;
+	
+	// Sorts the particles before vertex output so alpha blended emitters draw in a stable
+	// order.  Skipped for additive blending (a GL_ONE destination) where order is irrelevant
+	void	setSortMode( int mode );
+	int		getSortMode() const { return sortMode; }
+	void	setSortAxis( GLfloat x, GLfloat y ) { sync(); sortAxis = Vector2fMake( x, y ); }
+	
     void changeTexture(string path);
     string getTextureName();
     
+	// Call with false before loading to keep the emitter from creating any GL resources,
+	// e.g. to render headless with ofxParticleRasterizer.  Defaults to true
+	void			setUseTexture( bool useTexture ) { this->useTexture = useTexture; }
+	const ofImage*	getTexture() const { return texture; }
+    
 protected:
 	
+	friend class ofxParticleScheduler;
+	
 	void	parseParticleConfig();
 	void	setupArrays();
+	GLfloat	frameDelta();
+	void	simulate( GLfloat aDelta );
+	void	step( GLfloat aDelta, GLfloat deltaScale, bool keepPrevious );
+	void	stepSliced( GLfloat aDelta );
+	void	emitParticles( GLfloat aDelta );
+	void	integrateRange( int begin, int end, GLfloat aDelta, GLfloat deltaScale, bool keepPrevious );
+	void	integrateParticle( Particle* particle, GLfloat aDelta, GLfloat deltaScale, bool keepPrevious );
+	void	integrateSlice( GLfloat aDelta );
+	void	catchUpSlices();
+	void	finishStep( GLfloat aDelta );
+	
+	bool	usesTimeSlicing() const { return fixedTimestep <= 0.0f && ( updateInterval > 1 || slicePending ); }
+	void	finishFrame( GLfloat alpha );
+	void	fillVertices( PointSprite* out, int count, GLfloat alpha ) const;
+	void	applyLifetimeCurves( PointSprite* out, int count, GLfloat alpha ) const;
+	void	removeDeadParticles();
+	void	sortParticles();
+	
+	inline void	recordEvent( int type, const Particle* particle )
+	{
+		if ( eventTypes & PARTICLE_EVENT_MASK( type ) )
+			dispatchEvent( type, particle );
+	}
+	void	dispatchEvent( int type, const Particle* particle );
+	void	reserveSubEmitters();
+	void	threadedFunction();
 	
 	void	stopParticleEmitter();
 	bool	addParticle();
 	void	initParticle( Particle* particle );
 	
-	void	drawTextures();
-	void	drawPoints();
-	void	drawPointsOES();
+	void	drawTextures( const PointSprite* verts, int count ) const;
+	void	drawPoints( const PointSprite* verts, int count ) const;
+	void	drawPointsOES( const PointSprite* verts, int count ) const;
 	
 	ofxXmlSettings*	settings;
 
@@ -230,6 +427,43 @@ protected:
 	GLuint			verticesID;		// Holds the buffer name of the VBO that stores the color and vertices info for the particles
 	Particle*		particles;		// Array of particles that hold the particle emitters particle details
 	PointSprite*	vertices;		// Array of vertices and color information for each particle to be rendered
+	mutable bool	verticesDirty;	// vertices is behind the particles, filled on demand by getVertices()
+	GLfloat			fillAlpha;		// Interpolation between the last two steps for the next fill
+	
+	// Double buffered output used in threaded mode.  The worker writes vertices while
+	// draw() reads frontVertices, the two are swapped by update()
+	bool			threaded;
+	PointSprite*	frontVertices;
+	GLint			frontCount;
+	GLint			filledCount;	// particles the worker filled vertices for, spawnBatch() may add more
+	bool			frontActive;	// active as of the last update(), the worker may clear active
+	std::thread*	worker;
+	std::mutex		workerMutex;
+	std::condition_variable	workerCondition;
+	bool			workPending, workerExit;
+	GLfloat			pendingDelta;
+	
+	GLfloat			fixedTimestep;		// Seconds per step when a fixed update rate is set, 0 otherwise
+	GLfloat			fixedAccumulator;	// Time not yet consumed by a fixed step
+	
+	int				updateInterval;		// Slices the particles are integrated in, 1 integrates all every frame
+	int				slicePhase;			// Slice integrated next
+	bool			slicePending;		// Particles may still hold time from an earlier interval
+	
+	ofxParticleForceField*	forceField;
+	ofxParticleCollider*	collider;
+	
+	ofxParticleEventRing		eventRing;
+	int							eventMask;		// Event types recorded into eventRing
+	int							eventTypes;		// eventMask plus the types sub-emitters listen for
+	vector<SubEmitterBinding>	subEmitters;
+	
+	int					sortMode;
+	Vector2f			sortAxis;
+	ofxParticleSorter	sorter;
+	Particle*			sortScratch;	// Particles are gathered here in sorted order, then swapped in
+	
+	ofxParticleRandom	rng;
     string textureName;
 };
 
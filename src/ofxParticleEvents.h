@@ -0,0 +1,109 @@
+//
+// ofxParticleEvents.h
+//
+// Birth, death and collision events recorded by an emitter, and the single producer /
+// single consumer ring they are published through.  The emitter (or its worker thread)
+// pushes, game code pops; neither side takes a lock or allocates.
+//
+
+#ifndef _OFX_PARTICLE_EVENTS
+#define _OFX_PARTICLE_EVENTS
+
+#include "ofMain.h"
+
+#include <atomic>
+
+// Event type, also used as a bit index in event masks
+enum kParticleEventTypes
+{
+	kParticleEventBirth,
+	kParticleEventDeath,
+	kParticleEventCollision
+};
+
+#define PARTICLE_EVENT_MASK(__TYPE__) (1 << (__TYPE__))
+
+typedef struct
+{
+	int				type;
+	GLfloat			x, y;		// Where the event happened
+	GLfloat			vx, vy;		// Particle velocity at the time
+	ofFloatColor	color;
+} ParticleEvent;
+
+// ------------------------------------------------------------------------
+// ofxParticleEventRing
+// ------------------------------------------------------------------------
+
+class ofxParticleEventRing
+{
+
+public:
+
+	ofxParticleEventRing() : events( NULL ), mask( 0 ), dropped( 0 ), head( 0 ), tail( 0 ) {}
+	~ofxParticleEventRing() { if ( events != NULL ) free( events ); }
+
+	// Capacity is rounded up to a power of two.  Not safe while either side is active
+	void allocate( uint32_t capacity )
+	{
+		uint32_t size = 2;
+		while ( size < capacity )
+			size <<= 1;
+
+		if ( events != NULL ) free( events );
+		events = (ParticleEvent*)malloc( sizeof( ParticleEvent ) * size );
+		assert( events );
+
+		mask = size - 1;
+		head.store( 0 );
+		tail.store( 0 );
+		dropped = 0;
+	}
+
+	bool isAllocated() const { return events != NULL; }
+
+	// Producer side.  Events are dropped, and counted, when the consumer falls behind
+	bool push( const ParticleEvent& event )
+	{
+		uint32_t h = head.load( std::memory_order_relaxed );
+		if ( events == NULL || h - tail.load( std::memory_order_acquire ) > mask )
+		{
+			dropped++;
+			return false;
+		}
+
+		events[h & mask] = event;
+		head.store( h + 1, std::memory_order_release );
+		return true;
+	}
+
+	// Consumer side
+	bool pop( ParticleEvent& event )
+	{
+		uint32_t t = tail.load( std::memory_order_relaxed );
+		if ( t == head.load( std::memory_order_acquire ) )
+			return false;
+
+		event = events[t & mask];
+		tail.store( t + 1, std::memory_order_release );
+		return true;
+	}
+
+	uint32_t size() const { return head.load( std::memory_order_acquire ) - tail.load( std::memory_order_acquire ); }
+	uint32_t getDropped() const { return dropped; }
+
+protected:
+
+	ParticleEvent*			events;
+	uint32_t				mask;
+	uint32_t				dropped;	// Only touched by the producer
+	std::atomic<uint32_t>	head;		// Next slot the producer writes
+	std::atomic<uint32_t>	tail;		// Next slot the consumer reads
+
+private:
+
+	ofxParticleEventRing( const ofxParticleEventRing& );
+	ofxParticleEventRing& operator=( const ofxParticleEventRing& );
+};
+
+#endif
@@ -0,0 +1,266 @@
+//
+// ofxParticleForceField.cpp
+//
+
+#include "ofxParticleForceField.h"
+
+// ------------------------------------------------------------------------
+// Lifecycle
+// ------------------------------------------------------------------------
+
+ofxParticleForceField::ofxParticleForceField()
+{
+	cols = rows = 0;
+	origin = size = spacing = inverseSpacing = Vector2fZero;
+	dirty = false;
+	dirtyMinCol = dirtyMinRow = dirtyMaxCol = dirtyMaxRow = 0;
+
+	setup( 0.0f, 0.0f, 1024.0f, 768.0f, 64, 48 );
+}
+
+void ofxParticleForceField::setup( GLfloat x, GLfloat y, GLfloat width, GLfloat height, int numCols, int numRows )
+{
+	cols = MAX( 2, numCols );
+	rows = MAX( 2, numRows );
+	origin = Vector2fMake( x, y );
+	size = Vector2fMake( width, height );
+	spacing = Vector2fMake( width / ( cols - 1 ), height / ( rows - 1 ) );
+	inverseSpacing = Vector2fMake( spacing.x > 0.0f ? 1.0f / spacing.x : 0.0f,
+								   spacing.y > 0.0f ? 1.0f / spacing.y : 0.0f );
+
+	base.assign( cols * rows, Vector2fZero );
+	field.assign( cols * rows, Vector2fZero );
+
+	markAllDirty();
+	update();
+}
+
+// ------------------------------------------------------------------------
+// Sources
+// ------------------------------------------------------------------------
+
+int ofxParticleForceField::addSource( const ForceSource& source )
+{
+	sources.push_back( source );
+	markDirty( source );
+	return (int)sources.size() - 1;
+}
+
+int ofxParticleForceField::addPointSource( Vector2f position, GLfloat strength, GLfloat radius )
+{
+	ForceSource s = { kForceSourcePoint, position, strength, radius, 0.0f, 0.0f, true };
+	return addSource( s );
+}
+
+int ofxParticleForceField::addVortexSource( Vector2f position, GLfloat strength, GLfloat radius )
+{
+	ForceSource s = { kForceSourceVortex, position, strength, radius, 0.0f, 0.0f, true };
+	return addSource( s );
+}
+
+int ofxParticleForceField::addNoiseSource( GLfloat strength, GLfloat scale, GLfloat seed )
+{
+	ForceSource s = { kForceSourceNoise, Vector2fZero, strength, 0.0f, scale, seed, true };
+	return addSource( s );
+}
+
+int ofxParticleForceField::addUniformSource( Vector2f force )
+{
+	ForceSource s = { kForceSourceUniform, force, 1.0f, 0.0f, 0.0f, 0.0f, true };
+	return addSource( s );
+}
+
+void ofxParticleForceField::setSourcePosition( int source, Vector2f position )
+{
+	ForceSource& s = sources[source];
+	if ( s.position.x == position.x && s.position.y == position.y ) return;
+
+	// Both the cells the source used to cover and the ones it covers now need rebaking
+	markDirty( s );
+	s.position = position;
+	markDirty( s );
+}
+
+void ofxParticleForceField::setSourceStrength( int source, GLfloat strength )
+{
+	ForceSource& s = sources[source];
+	if ( s.strength == strength ) return;
+
+	s.strength = strength;
+	markDirty( s );
+}
+
+void ofxParticleForceField::setSourceEnabled( int source, bool enabled )
+{
+	ForceSource& s = sources[source];
+	if ( s.enabled == enabled ) return;
+
+	s.enabled = enabled;
+	markDirty( s );
+}
+
+// ------------------------------------------------------------------------
+// Baking
+// ------------------------------------------------------------------------
+
+void ofxParticleForceField::markAllDirty()
+{
+	dirty = true;
+	dirtyMinCol = dirtyMinRow = 0;
+	dirtyMaxCol = cols - 1;
+	dirtyMaxRow = rows - 1;
+}
+
+void ofxParticleForceField::markDirty( const ForceSource& source )
+{
+	// Global sources touch every cell
+	if ( source.type == kForceSourceNoise || source.type == kForceSourceUniform )
+	{
+		markAllDirty();
+		return;
+	}
+
+	int minCol = (int)floorf( ( source.position.x - source.radius - origin.x ) * inverseSpacing.x );
+	int maxCol = (int)ceilf( ( source.position.x + source.radius - origin.x ) * inverseSpacing.x );
+	int minRow = (int)floorf( ( source.position.y - source.radius - origin.y ) * inverseSpacing.y );
+	int maxRow = (int)ceilf( ( source.position.y + source.radius - origin.y ) * inverseSpacing.y );
+
+	minCol = MAX( 0, minCol );
+	minRow = MAX( 0, minRow );
+	maxCol = MIN( cols - 1, maxCol );
+	maxRow = MIN( rows - 1, maxRow );
+	if ( minCol > maxCol || minRow > maxRow ) return;
+
+	if ( !dirty )
+	{
+		dirty = true;
+		dirtyMinCol = minCol;
+		dirtyMinRow = minRow;
+		dirtyMaxCol = maxCol;
+		dirtyMaxRow = maxRow;
+	}
+	else
+	{
+		dirtyMinCol = MIN( dirtyMinCol, minCol );
+		dirtyMinRow = MIN( dirtyMinRow, minRow );
+		dirtyMaxCol = MAX( dirtyMaxCol, maxCol );
+		dirtyMaxRow = MAX( dirtyMaxRow, maxRow );
+	}
+}
+
+void ofxParticleForceField::update()
+{
+	if ( !dirty ) return;
+
+	rebake( dirtyMinCol, dirtyMinRow, dirtyMaxCol, dirtyMaxRow );
+	dirty = false;
+}
+
+void ofxParticleForceField::rebake( int minCol, int minRow, int maxCol, int maxRow )
+{
+	for ( int row = minRow; row <= maxRow; row++ )
+	{
+		for ( int col = minCol; col <= maxCol; col++ )
+		{
+			Vector2f at = Vector2fMake( origin.x + col * spacing.x, origin.y + row * spacing.y );
+			Vector2f force = base[row * cols + col];
+
+			for ( size_t i = 0; i < sources.size(); i++ )
+			{
+				if ( sources[i].enabled )
+					force = Vector2fAdd( force, evaluate( sources[i], at ) );
+			}
+
+			field[row * cols + col] = force;
+		}
+	}
+}
+
+Vector2f ofxParticleForceField::evaluate( const ForceSource& source, Vector2f at ) const
+{
+	switch ( source.type )
+	{
+		case kForceSourceUniform:
+			return Vector2fMultiply( source.position, source.strength );
+
+		case kForceSourceNoise:
+		{
+			float a = ofNoise( at.x * source.scale, at.y * source.scale, source.seed ) * TWO_PI * 2.0f;
+			return Vector2fMake( cosf( a ) * source.strength, sinf( a ) * source.strength );
+		}
+
+		case kForceSourcePoint:
+		case kForceSourceVortex:
+		{
+			Vector2f diff = Vector2fSub( source.position, at );
+			GLfloat distance = Vector2fLength( diff );
+			if ( distance >= source.radius || distance <= 0.0f )
+				return Vector2fZero;
+
+			// Linear falloff towards the edge of the radius
+			Vector2f dir = Vector2fMultiply( diff, source.strength * ( 1.0f - distance / source.radius ) / distance );
+			if ( source.type == kForceSourceVortex )
+				dir = Vector2fMake( -dir.y, dir.x );
+			return dir;
+		}
+	}
+
+	return Vector2fZero;
+}
+
+// ------------------------------------------------------------------------
+// Files
+// ------------------------------------------------------------------------
+
+bool ofxParticleForceField::loadFromFile( const std::string& filename )
+{
+	std::ifstream in( ofToDataPath( filename ).c_str() );
+	if ( !in )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleForceField::loadFromFile() - unable to open " + filename );
+		return false;
+	}
+
+	int fileCols = 0, fileRows = 0;
+	GLfloat x = 0.0f, y = 0.0f, width = 0.0f, height = 0.0f;
+	in >> fileCols >> fileRows >> x >> y >> width >> height;
+	if ( !in || fileCols < 2 || fileRows < 2 )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleForceField::loadFromFile() - invalid header in " + filename );
+		return false;
+	}
+
+	vector<Vector2f> loaded( fileCols * fileRows );
+	for ( size_t i = 0; i < loaded.size(); i++ )
+		in >> loaded[i].x >> loaded[i].y;
+
+	if ( !in )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleForceField::loadFromFile() - " + filename + " has too few samples" );
+		return false;
+	}
+
+	setup( x, y, width, height, fileCols, fileRows );
+	base.swap( loaded );
+
+	markAllDirty();
+	update();
+
+	return true;
+}
+
+bool ofxParticleForceField::saveToFile( const std::string& filename ) const
+{
+	std::ofstream out( ofToDataPath( filename ).c_str() );
+	if ( !out )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleForceField::saveToFile() - unable to open " + filename );
+		return false;
+	}
+
+	out << cols << " " << rows << " " << origin.x << " " << origin.y << " " << size.x << " " << size.y << "\n";
+	for ( size_t i = 0; i < field.size(); i++ )
+		out << field[i].x << " " << field[i].y << "\n";
+
+	return (bool)out;
+}
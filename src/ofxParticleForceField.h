@@ -0,0 +1,112 @@
+//
+// ofxParticleForceField.h
+//
+// A 2D grid of force vectors that emitters sample while integrating.  Any number of
+// analytic sources (attractors, vortices, noise, wind) are baked into the grid, so
+// the per-particle cost is a single bilinear lookup however many sources there are.
+// Moving a local source only rebakes the cells it touched.
+//
+
+#ifndef _OFX_PARTICLE_FORCE_FIELD
+#define _OFX_PARTICLE_FORCE_FIELD
+
+#include "ofxParticleEmitter.h"
+
+// Force source type
+enum kForceSourceTypes
+{
+	kForceSourcePoint,		// Pulls towards (or with negative strength pushes away from) position
+	kForceSourceVortex,		// Spins around position
+	kForceSourceNoise,		// Smooth noise over the whole field
+	kForceSourceUniform		// Constant force over the whole field, e.g. wind
+};
+
+typedef struct
+{
+	int			type;
+	Vector2f	position;		// Point and vortex centre, uniform force direction
+	GLfloat		strength;
+	GLfloat		radius;			// Point and vortex falloff radius, force is zero beyond it
+	GLfloat		scale;			// Noise frequency
+	GLfloat		seed;			// Noise offset
+	bool		enabled;
+} ForceSource;
+
+// ------------------------------------------------------------------------
+// ofxParticleForceField
+// ------------------------------------------------------------------------
+
+class ofxParticleForceField
+{
+
+public:
+
+	ofxParticleForceField();
+
+	// The grid has cols x rows sample nodes spread evenly over the given rectangle
+	void	setup( GLfloat x, GLfloat y, GLfloat width, GLfloat height, int cols, int rows );
+
+	int		addPointSource( Vector2f position, GLfloat strength, GLfloat radius );
+	int		addVortexSource( Vector2f position, GLfloat strength, GLfloat radius );
+	int		addNoiseSource( GLfloat strength, GLfloat scale, GLfloat seed = 0.0f );
+	int		addUniformSource( Vector2f force );
+
+	void	setSourcePosition( int source, Vector2f position );
+	void	setSourceStrength( int source, GLfloat strength );
+	void	setSourceEnabled( int source, bool enabled );
+	const ForceSource&	getSource( int source ) const { return sources[source]; }
+	int		getNumSources() const { return (int)sources.size(); }
+
+	// A loaded field becomes the base layer that sources are added on top of.  The
+	// file is text: "cols rows x y width height" followed by cols * rows "fx fy" pairs
+	bool	loadFromFile( const std::string& filename );
+	bool	saveToFile( const std::string& filename ) const;
+
+	// Rebakes the cells affected by source changes since the last call.  Call it before
+	// updating the emitters that use the field (after sync() for threaded emitters)
+	void	update();
+
+	// Bilinearly interpolated force at a world position, clamped to the grid edges
+	inline Vector2f sample( GLfloat x, GLfloat y ) const
+	{
+		GLfloat gx = ( x - origin.x ) * inverseSpacing.x;
+		GLfloat gy = ( y - origin.y ) * inverseSpacing.y;
+		gx = gx < 0.0f ? 0.0f : ( gx > cols - 1 ? cols - 1 : gx );
+		gy = gy < 0.0f ? 0.0f : ( gy > rows - 1 ? rows - 1 : gy );
+
+		int ix = MIN( (int)gx, cols - 2 );
+		int iy = MIN( (int)gy, rows - 2 );
+		GLfloat fx = gx - ix;
+		GLfloat fy = gy - iy;
+
+		const Vector2f* c = &field[iy * cols + ix];
+		Vector2f top = Vector2fAdd( c[0], Vector2fMultiply( Vector2fSub( c[1], c[0] ), fx ) );
+		Vector2f bottom = Vector2fAdd( c[cols], Vector2fMultiply( Vector2fSub( c[cols + 1], c[cols] ), fx ) );
+		return Vector2fAdd( top, Vector2fMultiply( Vector2fSub( bottom, top ), fy ) );
+	}
+
+	int			getCols() const { return cols; }
+	int			getRows() const { return rows; }
+	Vector2f	getOrigin() const { return origin; }
+	Vector2f	getSize() const { return size; }
+
+protected:
+
+	int		addSource( const ForceSource& source );
+	void	markDirty( const ForceSource& source );
+	void	markAllDirty();
+	void	rebake( int minCol, int minRow, int maxCol, int maxRow );
+	Vector2f	evaluate( const ForceSource& source, Vector2f at ) const;
+
+	Vector2f			origin, size, spacing, inverseSpacing;
+	int					cols, rows;
+
+	vector<Vector2f>	base;		// Loaded field, zero when none was loaded
+	vector<Vector2f>	field;		// base plus all baked sources
+	vector<ForceSource>	sources;
+
+	bool				dirty;
+	int					dirtyMinCol, dirtyMinRow, dirtyMaxCol, dirtyMaxRow;
+};
+
+#endif
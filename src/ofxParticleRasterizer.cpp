@@ -0,0 +1,254 @@
+//
+// ofxParticleRasterizer.cpp
+//
+
+#include "ofxParticleRasterizer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RASTER_USE_SSE 1
+#endif
+
+// ------------------------------------------------------------------------
+// Lifecycle
+// ------------------------------------------------------------------------
+
+ofxParticleRasterizer::ofxParticleRasterizer()
+{
+	width = height = 0;
+	spriteSource = NULL;
+	spriteWidth = spriteHeight = 0;
+}
+
+void ofxParticleRasterizer::allocate( int w, int h )
+{
+	width = MAX( 0, w );
+	height = MAX( 0, h );
+	buffer.assign( width * height * 4, 0.0f );
+	columnTexel.resize( width );
+}
+
+void ofxParticleRasterizer::clear( const ofFloatColor& color )
+{
+	for ( size_t i = 0; i < buffer.size(); i += 4 )
+	{
+		buffer[i + 0] = color.r;
+		buffer[i + 1] = color.g;
+		buffer[i + 2] = color.b;
+		buffer[i + 3] = color.a;
+	}
+}
+
+// ------------------------------------------------------------------------
+// Blending
+// ------------------------------------------------------------------------
+
+RasterBlendFactor ofxParticleRasterizer::blendFactor( int factor )
+{
+	RasterBlendFactor f = { { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f } };
+
+	switch ( factor )
+	{
+		case GL_ZERO:					break;
+		case GL_ONE:					f.k[0] = 1.0f; break;
+		case GL_SRC_COLOR:				f.k[1] = 1.0f; break;
+		case GL_ONE_MINUS_SRC_COLOR:	f.k[0] = 1.0f; f.k[1] = -1.0f; break;
+		case GL_SRC_ALPHA:				f.k[2] = 1.0f; break;
+		case GL_ONE_MINUS_SRC_ALPHA:	f.k[0] = 1.0f; f.k[2] = -1.0f; break;
+		case GL_DST_COLOR:				f.k[3] = 1.0f; break;
+		case GL_ONE_MINUS_DST_COLOR:	f.k[0] = 1.0f; f.k[3] = -1.0f; break;
+		case GL_DST_ALPHA:				f.k[4] = 1.0f; break;
+		case GL_ONE_MINUS_DST_ALPHA:	f.k[0] = 1.0f; f.k[4] = -1.0f; break;
+		default:
+			ofLog( OF_LOG_WARNING, "ofxParticleRasterizer::blendFactor() - unsupported blend factor " + ofToString( factor ) + ", using GL_ONE" );
+			f.k[0] = 1.0f;
+			break;
+	}
+
+	return f;
+}
+
+// ------------------------------------------------------------------------
+// Drawing
+// ------------------------------------------------------------------------
+
+void ofxParticleRasterizer::prepareSprite( const ofPixels* source )
+{
+	if ( source == NULL || !source->isAllocated() )
+	{
+		// A single white texel
+		spriteSource = NULL;
+		spriteWidth = spriteHeight = 1;
+		sprite.assign( 4, 1.0f );
+		return;
+	}
+
+	if ( source == spriteSource && spriteWidth == (int)source->getWidth() && spriteHeight == (int)source->getHeight() )
+		return;
+
+	spriteSource = source;
+	spriteWidth = source->getWidth();
+	spriteHeight = source->getHeight();
+
+	const int channels = source->getNumChannels();
+	const unsigned char* data = source->getData();
+	sprite.resize( spriteWidth * spriteHeight * 4 );
+
+	for ( int i = 0; i < spriteWidth * spriteHeight; i++ )
+	{
+		const unsigned char* texel = data + i * channels;
+		GLfloat* out = &sprite[i * 4];
+
+		// Match GL's expansion of luminance and luminance alpha textures
+		if ( channels >= 3 )
+		{
+			out[0] = texel[0] / 255.0f;
+			out[1] = texel[1] / 255.0f;
+			out[2] = texel[2] / 255.0f;
+		}
+		else
+		{
+			out[0] = out[1] = out[2] = texel[0] / 255.0f;
+		}
+		out[3] = ( channels == 4 || channels == 2 ) ? texel[channels - 1] / 255.0f : 1.0f;
+	}
+}
+
+void ofxParticleRasterizer::draw( const ofxParticleEmitter& emitter, int x, int y )
+{
+	const ofImage* texture = emitter.getTexture();
+	const ofPixels* pixels = texture != NULL ? &texture->getPixels() : NULL;
+
+	draw( emitter.getVertices(), emitter.getVertexCount(), pixels,
+		  emitter.blendFuncSource, emitter.blendFuncDestination, x, y );
+}
+
+void ofxParticleRasterizer::draw( const PointSprite* verts, int count, const ofPixels* source,
+								  int blendFuncSource, int blendFuncDestination, int x, int y )
+{
+	if ( verts == NULL || count <= 0 || buffer.empty() ) return;
+
+	prepareSprite( source );
+
+	const RasterBlendFactor fs = blendFactor( blendFuncSource );
+	const RasterBlendFactor fd = blendFactor( blendFuncDestination );
+
+#ifdef RASTER_USE_SSE
+	__m128 s0 = _mm_set1_ps( fs.k[0] ), s1 = _mm_set1_ps( fs.k[1] ), s2 = _mm_set1_ps( fs.k[2] ), s3 = _mm_set1_ps( fs.k[3] ), s4 = _mm_set1_ps( fs.k[4] );
+	__m128 d0 = _mm_set1_ps( fd.k[0] ), d1 = _mm_set1_ps( fd.k[1] ), d2 = _mm_set1_ps( fd.k[2] ), d3 = _mm_set1_ps( fd.k[3] ), d4 = _mm_set1_ps( fd.k[4] );
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+#endif
+
+	for ( int i = 0; i < count; i++ )
+	{
+		const PointSprite& ps = verts[i];
+		if ( ps.size <= 0.0f ) continue;
+
+		// Same footprint as texture->draw( x, y, size, size ) with a centred anchor
+		const GLfloat left = ps.x + x - ps.size * 0.5f;
+		const GLfloat top = ps.y + y - ps.size * 0.5f;
+		const GLfloat invSize = 1.0f / ps.size;
+
+		int px0 = MAX( 0, (int)ceilf( left - 0.5f ) );
+		int py0 = MAX( 0, (int)ceilf( top - 0.5f ) );
+		int px1 = MIN( width, (int)ceilf( left + ps.size - 0.5f ) );
+		int py1 = MIN( height, (int)ceilf( top + ps.size - 0.5f ) );
+		if ( px0 >= px1 || py0 >= py1 ) continue;
+
+		// Nearest texel column for every pixel of the span, shared by all rows
+		for ( int px = px0; px < px1; px++ )
+		{
+			int u = (int)( ( px + 0.5f - left ) * invSize * spriteWidth );
+			columnTexel[px] = MIN( spriteWidth - 1, MAX( 0, u ) ) * 4;
+		}
+
+		// GL clamps the vertex color to 0..1 before blending into a fixed point target,
+		// emitter colors often go outside that range through their variance.  Texels
+		// are already in range so clamping the tint clamps the source color
+#ifdef RASTER_USE_SSE
+		const __m128 tint = _mm_min_ps( one, _mm_max_ps( zero, _mm_setr_ps( ps.color.r, ps.color.g, ps.color.b, ps.color.a ) ) );
+#else
+		GLfloat tint[4] = { ps.color.r, ps.color.g, ps.color.b, ps.color.a };
+		for ( int c = 0; c < 4; c++ )
+			tint[c] = tint[c] < 0.0f ? 0.0f : ( tint[c] > 1.0f ? 1.0f : tint[c] );
+#endif
+
+		for ( int py = py0; py < py1; py++ )
+		{
+			int v = (int)( ( py + 0.5f - top ) * invSize * spriteHeight );
+			const GLfloat* row = &sprite[MIN( spriteHeight - 1, MAX( 0, v ) ) * spriteWidth * 4];
+			GLfloat* dst = &buffer[( py * width + px0 ) * 4];
+
+			for ( int px = px0; px < px1; px++, dst += 4 )
+			{
+				const GLfloat* texel = row + columnTexel[px];
+
+#ifdef RASTER_USE_SSE
+				__m128 src = _mm_mul_ps( _mm_loadu_ps( texel ), tint );
+				__m128 dstColor = _mm_loadu_ps( dst );
+				__m128 srcAlpha = _mm_shuffle_ps( src, src, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+				__m128 dstAlpha = _mm_shuffle_ps( dstColor, dstColor, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+
+				__m128 factorSrc = _mm_add_ps( _mm_add_ps( s0, _mm_mul_ps( s1, src ) ),
+											   _mm_add_ps( _mm_add_ps( _mm_mul_ps( s2, srcAlpha ), _mm_mul_ps( s3, dstColor ) ), _mm_mul_ps( s4, dstAlpha ) ) );
+				__m128 factorDst = _mm_add_ps( _mm_add_ps( d0, _mm_mul_ps( d1, src ) ),
+											   _mm_add_ps( _mm_add_ps( _mm_mul_ps( d2, srcAlpha ), _mm_mul_ps( d3, dstColor ) ), _mm_mul_ps( d4, dstAlpha ) ) );
+
+				__m128 out = _mm_add_ps( _mm_mul_ps( src, factorSrc ), _mm_mul_ps( dstColor, factorDst ) );
+				_mm_storeu_ps( dst, _mm_min_ps( one, _mm_max_ps( zero, out ) ) );
+#else
+				GLfloat src[4] = { texel[0] * tint[0], texel[1] * tint[1], texel[2] * tint[2], texel[3] * tint[3] };
+				const GLfloat srcAlpha = src[3], dstAlpha = dst[3];
+
+				for ( int c = 0; c < 4; c++ )
+				{
+					GLfloat factorSrc = fs.k[0] + fs.k[1] * src[c] + fs.k[2] * srcAlpha + fs.k[3] * dst[c] + fs.k[4] * dstAlpha;
+					GLfloat factorDst = fd.k[0] + fd.k[1] * src[c] + fd.k[2] * srcAlpha + fd.k[3] * dst[c] + fd.k[4] * dstAlpha;
+					GLfloat out = src[c] * factorSrc + dst[c] * factorDst;
+					dst[c] = out < 0.0f ? 0.0f : ( out > 1.0f ? 1.0f : out );
+				}
+#endif
+			}
+		}
+	}
+}
+
+// ------------------------------------------------------------------------
+// Output
+// ------------------------------------------------------------------------
+
+void ofxParticleRasterizer::readToPixels( ofPixels& pixels ) const
+{
+	pixels.allocate( width, height, OF_PIXELS_RGBA );
+
+	unsigned char* out = pixels.getData();
+	for ( size_t i = 0; i < buffer.size(); i++ )
+		out[i] = (unsigned char)( buffer[i] * 255.0f + 0.5f );
+}
+
+int ofxParticleRasterizer::countDifferences( const ofPixels& a, const ofPixels& b, int tolerance )
+{
+	if ( a.getWidth() != b.getWidth() || a.getHeight() != b.getHeight() || a.getNumChannels() != b.getNumChannels() )
+		return MAX( a.getWidth() * a.getHeight(), b.getWidth() * b.getHeight() );
+
+	const int channels = a.getNumChannels();
+	const int numPixels = a.getWidth() * a.getHeight();
+	const unsigned char* pa = a.getData();
+	const unsigned char* pb = b.getData();
+
+	int differences = 0;
+	for ( int i = 0; i < numPixels; i++ )
+	{
+		for ( int c = 0; c < channels; c++ )
+		{
+			if ( abs( (int)pa[i * channels + c] - (int)pb[i * channels + c] ) > tolerance )
+			{
+				differences++;
+				break;
+			}
+		}
+	}
+
+	return differences;
+}
@@ -0,0 +1,69 @@
+//
+// ofxParticleRasterizer.h
+//
+// CPU renderer for an emitter's vertex output.  Draws the textured sprites with the
+// configured GL blend factors into a float RGBA buffer without needing a GL context,
+// for headless preset previews and pixel-diff regression tests.  Blending runs four
+// channels at a time with SSE where available.
+//
+
+#ifndef _OFX_PARTICLE_RASTERIZER
+#define _OFX_PARTICLE_RASTERIZER
+
+#include "ofxParticleEmitter.h"
+
+// Blend factor expressed as k0 + k1 * src + k2 * src.alpha + k3 * dst + k4 * dst.alpha,
+// which covers every non-constant GL factor without branching per pixel
+typedef struct
+{
+	GLfloat		k[5];
+} RasterBlendFactor;
+
+// ------------------------------------------------------------------------
+// ofxParticleRasterizer
+// ------------------------------------------------------------------------
+
+class ofxParticleRasterizer
+{
+
+public:
+
+	ofxParticleRasterizer();
+
+	void	allocate( int width, int height );
+	void	clear( const ofFloatColor& color );
+
+	// Draws an emitter's current vertices with its texture and blend settings.  Load the
+	// emitter with setUseTexture( false ) to keep it from touching GL
+	void	draw( const ofxParticleEmitter& emitter, int x = 0, int y = 0 );
+
+	// A NULL sprite draws solid squares
+	void	draw( const PointSprite* verts, int count, const ofPixels* sprite,
+				  int blendFuncSource, int blendFuncDestination, int x = 0, int y = 0 );
+
+	void	readToPixels( ofPixels& pixels ) const;
+
+	int		getWidth() const { return width; }
+	int		getHeight() const { return height; }
+	const GLfloat*	getData() const { return buffer.empty() ? NULL : &buffer[0]; }
+
+	// Number of pixels where any channel differs by more than tolerance, for golden tests
+	static int	countDifferences( const ofPixels& a, const ofPixels& b, int tolerance = 0 );
+
+protected:
+
+	void		prepareSprite( const ofPixels* sprite );
+	static RasterBlendFactor	blendFactor( int factor );
+
+	int					width, height;
+	vector<GLfloat>		buffer;			// RGBA, row major
+
+	// Sprite converted to float RGBA, cached between draws of the same pixels
+	const ofPixels*		spriteSource;
+	int					spriteWidth, spriteHeight;
+	vector<GLfloat>		sprite;
+
+	vector<int>			columnTexel;	// Scratch, sprite column for each pixel of a span
+};
+
+#endif
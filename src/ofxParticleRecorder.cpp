@@ -0,0 +1,365 @@
+//
+// ofxParticleRecorder.cpp
+//
+
+#include "ofxParticleRecorder.h"
+
+#ifdef TARGET_WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Size in bytes of the particle columns of a frame, padded to a 4 byte boundary
+static inline size_t recordedFrameBytes( uint32_t count )
+{
+	size_t bytes = sizeof( RecordedFrameHeader ) + count * ( 3 * sizeof( uint16_t ) + 4 );
+	return ( bytes + 3 ) & ~(size_t)3;
+}
+
+static inline uint16_t quantize16( GLfloat v, GLfloat origin, GLfloat extent )
+{
+	if ( extent <= 0.0f ) return 0;
+	GLfloat t = ( v - origin ) / extent;
+	if ( t < 0.0f ) t = 0.0f;
+	if ( t > 1.0f ) t = 1.0f;
+	return (uint16_t)( t * 65535.0f + 0.5f );
+}
+
+static inline unsigned char quantize8( GLfloat v )
+{
+	if ( v < 0.0f ) v = 0.0f;
+	if ( v > 1.0f ) v = 1.0f;
+	return (unsigned char)( v * 255.0f + 0.5f );
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleRecorder
+// ------------------------------------------------------------------------
+
+ofxParticleRecorder::ofxParticleRecorder()
+{
+	file = NULL;
+	memset( &header, 0, sizeof( header ) );
+}
+
+ofxParticleRecorder::~ofxParticleRecorder()
+{
+	close();
+}
+
+bool ofxParticleRecorder::open( const std::string& filename )
+{
+	close();
+
+	file = fopen( ofToDataPath( filename ).c_str(), "wb" );
+	if ( file == NULL )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleRecorder::open() - unable to open " + filename + " for writing" );
+		return false;
+	}
+
+	memset( &header, 0, sizeof( header ) );
+	header.magic = PARTICLE_RECORDING_MAGIC;
+	header.version = PARTICLE_RECORDING_VERSION;
+	frameOffsets.clear();
+
+	// The header is rewritten by close() once the frame count and index are known
+	fwrite( &header, sizeof( header ), 1, file );
+
+	return true;
+}
+
+bool ofxParticleRecorder::addFrame( const ofxParticleEmitter& emitter )
+{
+	header.blendFuncSource = emitter.blendFuncSource;
+	header.blendFuncDestination = emitter.blendFuncDestination;
+
+	return addFrame( emitter.getVertices(), emitter.getVertexCount() );
+}
+
+bool ofxParticleRecorder::addFrame( const PointSprite* verts, int count )
+{
+	if ( file == NULL ) return false;
+	if ( verts == NULL || count < 0 ) count = 0;
+
+	// Find the bounds of the frame so positions and sizes can be quantized against them
+	RecordedFrameHeader frame;
+	memset( &frame, 0, sizeof( frame ) );
+	frame.count = count;
+
+	if ( count > 0 )
+	{
+		GLfloat maxX = verts[0].x, maxY = verts[0].y;
+		frame.minX = verts[0].x;
+		frame.minY = verts[0].y;
+		for ( int i = 1; i < count; i++ )
+		{
+			frame.minX = MIN( frame.minX, verts[i].x );
+			frame.minY = MIN( frame.minY, verts[i].y );
+			maxX = MAX( maxX, verts[i].x );
+			maxY = MAX( maxY, verts[i].y );
+		}
+		for ( int i = 0; i < count; i++ )
+			frame.maxSize = MAX( frame.maxSize, verts[i].size );
+		frame.extentX = maxX - frame.minX;
+		frame.extentY = maxY - frame.minY;
+	}
+
+	size_t bytes = recordedFrameBytes( count );
+	if ( scratch.size() < bytes )
+		scratch.resize( bytes );
+	memset( &scratch[0], 0, bytes );
+
+	memcpy( &scratch[0], &frame, sizeof( frame ) );
+	uint16_t* xs = (uint16_t*)( &scratch[0] + sizeof( frame ) );
+	uint16_t* ys = xs + count;
+	uint16_t* sizes = ys + count;
+	unsigned char* colors = (unsigned char*)( sizes + count );
+
+	for ( int i = 0; i < count; i++ )
+	{
+		const PointSprite& ps = verts[i];
+		xs[i] = quantize16( ps.x, frame.minX, frame.extentX );
+		ys[i] = quantize16( ps.y, frame.minY, frame.extentY );
+		sizes[i] = quantize16( ps.size, 0.0f, frame.maxSize );
+		colors[i * 4 + 0] = quantize8( ps.color.r );
+		colors[i * 4 + 1] = quantize8( ps.color.g );
+		colors[i * 4 + 2] = quantize8( ps.color.b );
+		colors[i * 4 + 3] = quantize8( ps.color.a );
+	}
+
+	frameOffsets.push_back( (uint64_t)ftell( file ) );
+	if ( fwrite( &scratch[0], bytes, 1, file ) != 1 )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleRecorder::addFrame() - write failed" );
+		frameOffsets.pop_back();
+		return false;
+	}
+
+	header.maxCount = MAX( header.maxCount, (uint32_t)count );
+
+	return true;
+}
+
+bool ofxParticleRecorder::close()
+{
+	if ( file == NULL ) return false;
+
+	// Append the frame index and patch the header now that everything is known
+	header.frameCount = frameOffsets.size();
+	header.indexOffset = (uint64_t)ftell( file );
+
+	bool ok = true;
+	if ( !frameOffsets.empty() )
+		ok = fwrite( &frameOffsets[0], sizeof( uint64_t ), frameOffsets.size(), file ) == frameOffsets.size();
+
+	fseek( file, 0, SEEK_SET );
+	ok = ok && fwrite( &header, sizeof( header ), 1, file ) == 1;
+
+	fclose( file );
+	file = NULL;
+
+	if ( !ok )
+		ofLog( OF_LOG_ERROR, "ofxParticleRecorder::close() - failed to finalize recording" );
+
+	return ok;
+}
+
+// ------------------------------------------------------------------------
+// ofxParticlePlayback
+// ------------------------------------------------------------------------
+
+ofxParticlePlayback::ofxParticlePlayback()
+{
+	data = NULL;
+	dataSize = 0;
+#ifdef TARGET_WIN32
+	fileHandle = mappingHandle = NULL;
+#else
+	fileDescriptor = -1;
+#endif
+	vertices = NULL;
+	vertexCount = 0;
+	currentFrame = -1;
+}
+
+ofxParticlePlayback::~ofxParticlePlayback()
+{
+	close();
+}
+
+bool ofxParticlePlayback::load( const std::string& filename )
+{
+	close();
+
+	std::string path = ofToDataPath( filename );
+
+#ifdef TARGET_WIN32
+	HANDLE fh = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( fh == INVALID_HANDLE_VALUE )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticlePlayback::load() - unable to open " + filename );
+		return false;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx( fh, &size );
+	HANDLE mh = CreateFileMappingA( fh, NULL, PAGE_READONLY, 0, 0, NULL );
+	const void* mapped = mh ? MapViewOfFile( mh, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+	fileHandle = fh;
+	mappingHandle = mh;
+	dataSize = (size_t)size.QuadPart;
+#else
+	fileDescriptor = ::open( path.c_str(), O_RDONLY );
+	if ( fileDescriptor < 0 )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticlePlayback::load() - unable to open " + filename );
+		return false;
+	}
+	struct stat st;
+	fstat( fileDescriptor, &st );
+	dataSize = (size_t)st.st_size;
+	const void* mapped = dataSize > 0 ? mmap( NULL, dataSize, PROT_READ, MAP_SHARED, fileDescriptor, 0 ) : MAP_FAILED;
+	if ( mapped == MAP_FAILED )
+		mapped = NULL;
+#endif
+
+	data = (const unsigned char*)mapped;
+
+	const RecordedStreamHeader* h = getHeader();
+	if ( data == NULL || dataSize < sizeof( RecordedStreamHeader ) ||
+		 h->magic != PARTICLE_RECORDING_MAGIC || h->version != PARTICLE_RECORDING_VERSION ||
+		 h->indexOffset > dataSize || h->frameCount > ( dataSize - h->indexOffset ) / sizeof( uint64_t ) )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticlePlayback::load() - " + filename + " is not a valid particle recording" );
+		close();
+		return false;
+	}
+
+	vertices = (PointSprite*)malloc( sizeof( PointSprite ) * MAX( 1u, h->maxCount ) );
+	assert( vertices );
+
+	// A recording closed before any frames were added is valid, it just shows nothing
+	if ( h->frameCount == 0 )
+		return true;
+
+	if ( !setFrame( 0 ) )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticlePlayback::load() - " + filename + " has a malformed first frame" );
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void ofxParticlePlayback::close()
+{
+#ifdef TARGET_WIN32
+	if ( data != NULL )
+		UnmapViewOfFile( data );
+	if ( mappingHandle != NULL )
+		CloseHandle( (HANDLE)mappingHandle );
+	if ( fileHandle != NULL )
+		CloseHandle( (HANDLE)fileHandle );
+	fileHandle = mappingHandle = NULL;
+#else
+	if ( data != NULL )
+		munmap( (void*)data, dataSize );
+	if ( fileDescriptor >= 0 )
+		::close( fileDescriptor );
+	fileDescriptor = -1;
+#endif
+	data = NULL;
+	dataSize = 0;
+
+	if ( vertices != NULL )
+		free( vertices );
+	vertices = NULL;
+	vertexCount = 0;
+	currentFrame = -1;
+}
+
+int ofxParticlePlayback::getNumFrames() const
+{
+	return data != NULL ? getHeader()->frameCount : 0;
+}
+
+int ofxParticlePlayback::getMaxCount() const
+{
+	return data != NULL ? getHeader()->maxCount : 0;
+}
+
+int ofxParticlePlayback::getBlendFuncSource() const
+{
+	return data != NULL ? getHeader()->blendFuncSource : 0;
+}
+
+int ofxParticlePlayback::getBlendFuncDestination() const
+{
+	return data != NULL ? getHeader()->blendFuncDestination : 0;
+}
+
+bool ofxParticlePlayback::setFrame( int frame )
+{
+	if ( frame == currentFrame ) return true;
+
+	int count = decodeFrame( frame, vertices );
+	if ( count < 0 ) return false;
+
+	vertexCount = count;
+	currentFrame = frame;
+
+	return true;
+}
+
+int ofxParticlePlayback::decodeFrame( int frame, PointSprite* out ) const
+{
+	if ( data == NULL || out == NULL || frame < 0 || frame >= getNumFrames() )
+		return -1;
+
+	uint64_t offset;
+	memcpy( &offset, data + getHeader()->indexOffset + frame * sizeof( uint64_t ), sizeof( offset ) );
+
+	// Frames are written 4 byte aligned, anything else means the index is corrupt
+	if ( ( offset & 3 ) != 0 || offset > dataSize || dataSize - offset < sizeof( RecordedFrameHeader ) )
+		return -1;
+
+	// out only has room for maxCount vertices
+	const RecordedFrameHeader* h = (const RecordedFrameHeader*)( data + offset );
+	if ( h->count > getHeader()->maxCount || dataSize - offset < recordedFrameBytes( h->count ) )
+		return -1;
+
+	const uint32_t count = h->count;
+	const uint16_t* xs = (const uint16_t*)( h + 1 );
+	const uint16_t* ys = xs + count;
+	const uint16_t* sizes = ys + count;
+	const unsigned char* colors = (const unsigned char*)( sizes + count );
+
+	const GLfloat sx = h->extentX / 65535.0f;
+	const GLfloat sy = h->extentY / 65535.0f;
+	const GLfloat ss = h->maxSize / 65535.0f;
+	const GLfloat sc = 1.0f / 255.0f;
+
+	for ( uint32_t i = 0; i < count; i++ )
+	{
+		PointSprite& ps = out[i];
+		ps.x = h->minX + xs[i] * sx;
+		ps.y = h->minY + ys[i] * sy;
+		ps.size = sizes[i] * ss;
+		ps.color.r = colors[i * 4 + 0] * sc;
+		ps.color.g = colors[i * 4 + 1] * sc;
+		ps.color.b = colors[i * 4 + 2] * sc;
+		ps.color.a = colors[i * 4 + 3] * sc;
+	}
+
+	return count;
+}
+
+void ofxParticlePlayback::draw( const ofxParticleEmitter& look, int x, int y ) const
+{
+	look.drawVertices( vertices, vertexCount, x, y );
+}
@@ -0,0 +1,130 @@
+//
+// ofxParticleRecorder.h
+//
+// Records the per-frame vertex output of an ofxParticleEmitter into a compact,
+// quantized stream file and plays it back from a memory mapping without running
+// the simulation.
+//
+
+#ifndef _OFX_PARTICLE_RECORDER
+#define _OFX_PARTICLE_RECORDER
+
+#include "ofxParticleEmitter.h"
+
+// ------------------------------------------------------------------------
+// File layout
+// ------------------------------------------------------------------------
+//
+// [header][frame 0][frame 1]...[frame N-1][index: N x uint64 frame offsets]
+//
+// Each frame starts with a RecordedFrameHeader followed by its particles stored
+// as columns: uint16 x[count], uint16 y[count], uint16 size[count] and
+// uint8 rgba[count * 4].  Positions and sizes are quantized against the frame's
+// bounds, colors are clamped to 0..1 and stored as bytes.  Frames are padded to a
+// 4 byte boundary so the headers can be read straight out of the mapping.
+
+#define PARTICLE_RECORDING_MAGIC	0x52584550	// "PEXR"
+#define PARTICLE_RECORDING_VERSION	1
+
+typedef struct
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	frameCount;
+	uint32_t	maxCount;		// Largest particle count of any frame
+	int32_t		blendFuncSource;
+	int32_t		blendFuncDestination;
+	uint64_t	indexOffset;	// Byte offset of the frame offset table
+} RecordedStreamHeader;
+
+typedef struct
+{
+	GLfloat		minX, minY;
+	GLfloat		extentX, extentY;
+	GLfloat		maxSize;
+	uint32_t	count;
+} RecordedFrameHeader;
+
+// ------------------------------------------------------------------------
+// ofxParticleRecorder
+// ------------------------------------------------------------------------
+
+class ofxParticleRecorder
+{
+
+public:
+
+	ofxParticleRecorder();
+	~ofxParticleRecorder();
+
+	bool	open( const std::string& filename );
+	bool	addFrame( const ofxParticleEmitter& emitter );
+	bool	addFrame( const PointSprite* verts, int count );
+	bool	close();
+
+	bool	isOpen() const { return file != NULL; }
+	int		getNumFrames() const { return (int)frameOffsets.size(); }
+
+protected:
+
+	FILE*					file;
+	RecordedStreamHeader	header;
+	vector<uint64_t>		frameOffsets;
+	vector<unsigned char>	scratch;		// Reused encode buffer, grows to the largest frame
+};
+
+// ------------------------------------------------------------------------
+// ofxParticlePlayback
+// ------------------------------------------------------------------------
+
+class ofxParticlePlayback
+{
+
+public:
+
+	ofxParticlePlayback();
+	~ofxParticlePlayback();
+
+	bool	load( const std::string& filename );
+	void	close();
+
+	// Decodes a single frame into the internal vertex buffer.  Frames can be
+	// requested in any order, so this doubles as the scrubbing API
+	bool	setFrame( int frame );
+
+	// Decodes a frame into out, which needs room for getMaxCount() vertices.  Returns
+	// the vertex count, or -1 for a missing or malformed frame
+	int		decodeFrame( int frame, PointSprite* out ) const;
+
+	// Draws the current frame with the texture and blend settings of an emitter
+	void	draw( const ofxParticleEmitter& look, int x = 0, int y = 0 ) const;
+
+	bool				isLoaded() const { return data != NULL; }
+	int					getNumFrames() const;
+	int					getCurrentFrame() const { return currentFrame; }
+	int					getMaxCount() const;
+	int					getBlendFuncSource() const;
+	int					getBlendFuncDestination() const;
+	const PointSprite*	getVertices() const { return vertices; }
+	int					getVertexCount() const { return vertexCount; }
+
+protected:
+
+	const RecordedStreamHeader*	getHeader() const { return (const RecordedStreamHeader*)data; }
+
+	const unsigned char*	data;
+	size_t					dataSize;
+
+#ifdef TARGET_WIN32
+	void*					fileHandle;
+	void*					mappingHandle;
+#else
+	int						fileDescriptor;
+#endif
+
+	PointSprite*			vertices;
+	int						vertexCount;
+	int						currentFrame;
+};
+
+#endif
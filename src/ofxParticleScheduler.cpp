@@ -0,0 +1,292 @@
+//
+// ofxParticleScheduler.cpp
+//
+
+#include "ofxParticleScheduler.h"
+
+// ------------------------------------------------------------------------
+// ofxParticleWorkerPool
+// ------------------------------------------------------------------------
+
+ofxParticleWorkerPool::ofxParticleWorkerPool()
+{
+	generation = 0;
+	exiting = false;
+	job = NULL;
+	remaining.store( 0 );
+}
+
+ofxParticleWorkerPool::~ofxParticleWorkerPool()
+{
+	stop();
+}
+
+void ofxParticleWorkerPool::setup( int numThreads )
+{
+	stop();
+
+	if ( numThreads <= 0 )
+		numThreads = MAX( 1, (int)std::thread::hardware_concurrency() );
+
+	for ( int i = 0; i < numThreads; i++ )
+		queues.push_back( new TaskQueue );
+
+	exiting = false;
+	for ( int i = 1; i < numThreads; i++ )
+		threads.push_back( new std::thread( &ofxParticleWorkerPool::threadedFunction, this, i ) );
+}
+
+void ofxParticleWorkerPool::stop()
+{
+	{
+		std::unique_lock<std::mutex> lock( runMutex );
+		exiting = true;
+		runCondition.notify_all();
+	}
+
+	for ( size_t i = 0; i < threads.size(); i++ )
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+	threads.clear();
+
+	for ( size_t i = 0; i < queues.size(); i++ )
+		delete queues[i];
+	queues.clear();
+}
+
+void ofxParticleWorkerPool::run( int numTasks, const std::function<void(int)>& fn )
+{
+	if ( numTasks <= 0 ) return;
+
+	if ( queues.empty() )
+		setup();
+
+	// Without helpers, or for a single task, there is nothing to distribute
+	if ( queues.size() == 1 || numTasks == 1 )
+	{
+		for ( int i = 0; i < numTasks; i++ )
+			fn( i );
+		return;
+	}
+
+	job = &fn;
+	remaining.store( numTasks );
+
+	// Deal the tasks out round robin, stealing evens out whatever imbalance is left
+	for ( int i = 0; i < numTasks; i++ )
+	{
+		TaskQueue* queue = queues[i % queues.size()];
+		std::unique_lock<std::mutex> lock( queue->mutex );
+		queue->tasks.push_back( i );
+	}
+
+	{
+		std::unique_lock<std::mutex> lock( runMutex );
+		generation++;
+		runCondition.notify_all();
+	}
+
+	work( 0 );
+
+	// Other threads may still be finishing their last task
+	while ( remaining.load( std::memory_order_acquire ) > 0 )
+		std::this_thread::yield();
+
+	job = NULL;
+}
+
+bool ofxParticleWorkerPool::takeTask( int worker, int& task )
+{
+	// Newest task from our own queue first, it is most likely still in cache...
+	{
+		TaskQueue* own = queues[worker];
+		std::unique_lock<std::mutex> lock( own->mutex );
+		if ( !own->tasks.empty() )
+		{
+			task = own->tasks.back();
+			own->tasks.pop_back();
+			return true;
+		}
+	}
+
+	// ...otherwise steal the oldest task from someone else
+	for ( size_t i = 1; i < queues.size(); i++ )
+	{
+		TaskQueue* victim = queues[( worker + i ) % queues.size()];
+		std::unique_lock<std::mutex> lock( victim->mutex );
+		if ( !victim->tasks.empty() )
+		{
+			task = victim->tasks.front();
+			victim->tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ofxParticleWorkerPool::work( int worker )
+{
+	int task;
+	while ( takeTask( worker, task ) )
+	{
+		(*job)( task );
+		remaining.fetch_sub( 1, std::memory_order_release );
+	}
+}
+
+void ofxParticleWorkerPool::threadedFunction( int worker )
+{
+	uint64_t seen = 0;
+
+	while ( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( runMutex );
+			while ( generation == seen && !exiting )
+				runCondition.wait( lock );
+			if ( exiting )
+				return;
+			seen = generation;
+		}
+
+		work( worker );
+	}
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleScheduler
+// ------------------------------------------------------------------------
+
+ofxParticleScheduler::ofxParticleScheduler()
+{
+	chunkSize = 4096;
+}
+
+void ofxParticleScheduler::add( ofxParticleEmitter* emitter )
+{
+	if ( emitter == NULL ) return;
+	if ( std::find( emitters.begin(), emitters.end(), emitter ) == emitters.end() )
+		emitters.push_back( emitter );
+}
+
+void ofxParticleScheduler::remove( ofxParticleEmitter* emitter )
+{
+	emitters.erase( std::remove( emitters.begin(), emitters.end(), emitter ), emitters.end() );
+}
+
+void ofxParticleScheduler::update()
+{
+	const int numEmitters = emitters.size();
+	deltas.assign( numEmitters, -1.0f );
+	grouped.clear();
+	large.clear();
+	tasks.clear();
+
+	// Work out what each emitter needs.  Fixed rate emitters may take several steps in
+	// a frame and time sliced ones already skip most particles, so they always run whole
+	int groupStart = 0, groupParticles = 0;
+	for ( int i = 0; i < numEmitters; i++ )
+	{
+		ofxParticleEmitter* e = emitters[i];
+
+		if ( e->isThreaded() )
+		{
+			e->update();
+			continue;
+		}
+		if ( !e->active ) continue;
+
+		deltas[i] = e->frameDelta();
+		e->reserveSubEmitters();
+
+		if ( e->fixedTimestep <= 0.0f && !e->usesTimeSlicing() && e->particleCount >= chunkSize * 2 )
+		{
+			large.push_back( i );
+			ScheduledTask task = { kTaskEmit, i, 0, 0 };
+			tasks.push_back( task );
+			continue;
+		}
+
+		grouped.push_back( i );
+		groupParticles += e->particleCount + 1;
+		if ( groupParticles >= chunkSize )
+		{
+			ScheduledTask task = { kTaskGroup, 0, groupStart, (int)grouped.size() };
+			tasks.push_back( task );
+			groupStart = grouped.size();
+			groupParticles = 0;
+		}
+	}
+	if ( groupStart < (int)grouped.size() )
+	{
+		ScheduledTask task = { kTaskGroup, 0, groupStart, (int)grouped.size() };
+		tasks.push_back( task );
+	}
+
+	// Small emitters run to completion while the large ones emit
+	runTasks();
+
+	// Integrate the large emitters in chunks...
+	tasks.clear();
+	for ( size_t i = 0; i < large.size(); i++ )
+	{
+		int count = emitters[large[i]]->particleCount;
+		for ( int begin = 0; begin < count; begin += chunkSize )
+		{
+			ScheduledTask task = { kTaskIntegrate, large[i], begin, MIN( count, begin + chunkSize ) };
+			tasks.push_back( task );
+		}
+	}
+	runTasks();
+
+	// ...then compact, collide and sort each of them
+	tasks.clear();
+	for ( size_t i = 0; i < large.size(); i++ )
+	{
+		ScheduledTask task = { kTaskFinish, large[i], 0, 0 };
+		tasks.push_back( task );
+	}
+	runTasks();
+
+	// Sub-emitters may feed emitters updated by other tasks, so hand events over last
+	for ( int i = 0; i < numEmitters; i++ )
+	{
+		if ( deltas[i] >= 0.0f )
+			emitters[i]->flushSubEmitters();
+	}
+}
+
+void ofxParticleScheduler::runTasks()
+{
+	pool.run( tasks.size(), [this]( int t ) {
+		const ScheduledTask& task = tasks[t];
+
+		switch ( task.type )
+		{
+			case kTaskGroup:
+				for ( int g = task.begin; g < task.end; g++ )
+					emitters[grouped[g]]->simulate( deltas[grouped[g]] );
+				break;
+
+			case kTaskEmit:
+				emitters[task.emitter]->emitParticles( deltas[task.emitter] );
+				break;
+
+			case kTaskIntegrate:
+				emitters[task.emitter]->integrateRange( task.begin, task.end, deltas[task.emitter], 1.0f, false );
+				break;
+
+			case kTaskFinish:
+			{
+				ofxParticleEmitter* e = emitters[task.emitter];
+				e->finishStep( deltas[task.emitter] );
+				e->sortParticles();
+				e->finishFrame( 1.0f );
+				break;
+			}
+		}
+	} );
+}
@@ -0,0 +1,119 @@
+//
+// ofxParticleScheduler.h
+//
+// Updates many emitters at once on a work-stealing thread pool.  Small emitters are
+// grouped into one task, large ones are split into chunks of particles that are
+// integrated in parallel, with emission and compaction done per emitter around them.
+// Emitters draw random numbers from their own generator, so nothing mutable is shared
+// between tasks.  A collider keeps scratch state, so give each scheduled emitter its
+// own; force fields are only read and can be shared.
+//
+
+#ifndef _OFX_PARTICLE_SCHEDULER
+#define _OFX_PARTICLE_SCHEDULER
+
+#include "ofxParticleEmitter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+
+// ------------------------------------------------------------------------
+// ofxParticleWorkerPool
+// ------------------------------------------------------------------------
+
+// Every thread owns a task queue.  Threads pop their own newest task first and steal
+// the oldest task of another queue when theirs runs dry.  The calling thread takes
+// part as worker 0
+class ofxParticleWorkerPool
+{
+
+public:
+
+	ofxParticleWorkerPool();
+	~ofxParticleWorkerPool();
+
+	// numThreads includes the calling thread, 0 picks one per hardware thread
+	void	setup( int numThreads = 0 );
+	void	stop();
+
+	// Calls job( i ) for every i in [0, numTasks) and returns when all have finished
+	void	run( int numTasks, const std::function<void(int)>& job );
+
+	int		getNumThreads() const { return (int)queues.size(); }
+
+protected:
+
+	typedef struct
+	{
+		std::mutex			mutex;
+		std::deque<int>		tasks;
+	} TaskQueue;
+
+	bool	takeTask( int worker, int& task );
+	void	work( int worker );
+	void	threadedFunction( int worker );
+
+	vector<TaskQueue*>		queues;
+	vector<std::thread*>	threads;
+
+	std::mutex				runMutex;
+	std::condition_variable	runCondition;
+	uint64_t				generation;		// Bumped for every run() so workers know to wake
+	bool					exiting;
+
+	const std::function<void(int)>*	job;
+	std::atomic<int>		remaining;
+};
+
+// ------------------------------------------------------------------------
+// ofxParticleScheduler
+// ------------------------------------------------------------------------
+
+class ofxParticleScheduler
+{
+
+public:
+
+	ofxParticleScheduler();
+
+	void	setup( int numThreads = 0 ) { pool.setup( numThreads ); }
+
+	// Emitters are not owned.  Threaded emitters keep their own worker and are just
+	// told to update()
+	void	add( ofxParticleEmitter* emitter );
+	void	remove( ofxParticleEmitter* emitter );
+	void	clear() { emitters.clear(); }
+
+	// Replaces calling update() on every registered emitter
+	void	update();
+
+	// Particles per integration task.  Emitters with fewer than twice this many are
+	// updated whole, grouped with other small emitters up to about this many particles
+	void	setChunkSize( int chunkSize ) { this->chunkSize = MAX( 1, chunkSize ); }
+	int		getNumThreads() const { return pool.getNumThreads(); }
+
+protected:
+
+	enum { kTaskGroup, kTaskEmit, kTaskIntegrate, kTaskFinish };
+
+	typedef struct
+	{
+		int		type;
+		int		emitter;		// Index into emitters, or first entry of grouped for groups
+		int		begin, end;		// Particle range, or range of grouped for groups
+	} ScheduledTask;
+
+	void	runTasks();
+
+	ofxParticleWorkerPool		pool;
+	vector<ofxParticleEmitter*>	emitters;
+	vector<GLfloat>				deltas;		// Frame delta per emitter, negative when skipped
+	vector<int>					grouped;	// Indices of small emitters, in group order
+	vector<int>					large;		// Indices of emitters split into chunks
+	vector<ScheduledTask>		tasks;
+	int							chunkSize;
+};
+
+#endif
@@ -0,0 +1,235 @@
+//
+// ofxParticleShape.cpp
+//
+
+#include "ofxParticleShape.h"
+
+// ------------------------------------------------------------------------
+// ofxParticleAliasTable
+// ------------------------------------------------------------------------
+
+void ofxParticleAliasTable::build( const vector<float>& weights )
+{
+	const int n = (int)weights.size();
+	probability.assign( n, 1.0f );
+	alias.resize( n );
+	if ( n == 0 ) return;
+
+	double sum = 0.0;
+	for ( int i = 0; i < n; i++ )
+		sum += MAX( 0.0f, weights[i] );
+	if ( sum <= 0.0 )
+	{
+		for ( int i = 0; i < n; i++ )
+			alias[i] = i;
+		return;
+	}
+
+	// Scale so the average weight is 1 and split into under and over full slots
+	vector<double> scaled( n );
+	vector<int> small, large;
+	small.reserve( n );
+	large.reserve( n );
+	for ( int i = 0; i < n; i++ )
+	{
+		scaled[i] = MAX( 0.0f, weights[i] ) * n / sum;
+		if ( scaled[i] < 1.0 )
+			small.push_back( i );
+		else
+			large.push_back( i );
+	}
+
+	// Top up each under full slot from an over full one
+	while ( !small.empty() && !large.empty() )
+	{
+		int s = small.back(); small.pop_back();
+		int l = large.back();
+
+		probability[s] = (float)scaled[s];
+		alias[s] = l;
+
+		scaled[l] -= 1.0 - scaled[s];
+		if ( scaled[l] < 1.0 )
+		{
+			large.pop_back();
+			small.push_back( l );
+		}
+	}
+
+	// Whatever is left over is full up to rounding error
+	for ( size_t i = 0; i < large.size(); i++ )
+	{
+		probability[large[i]] = 1.0f;
+		alias[large[i]] = large[i];
+	}
+	for ( size_t i = 0; i < small.size(); i++ )
+	{
+		probability[small[i]] = 1.0f;
+		alias[small[i]] = small[i];
+	}
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleEmitterShape
+// ------------------------------------------------------------------------
+
+ofxParticleEmitterShape::ofxParticleEmitterShape()
+{
+	clear();
+}
+
+void ofxParticleEmitterShape::clear()
+{
+	type = kEmitterShapeBox;
+	x1 = y1 = x2 = y2 = 0.0f;
+	innerRadiusSq = outerRadiusSq = 0.0f;
+	maskScale = 1.0f;
+	maskOffsetX = maskOffsetY = 0.0f;
+	points.clear();
+	pixels.clear();
+	table.clear();
+}
+
+void ofxParticleEmitterShape::setLine( float ax, float ay, float bx, float by )
+{
+	clear();
+	type = kEmitterShapeLine;
+	x1 = ax; y1 = ay;
+	x2 = bx; y2 = by;
+}
+
+void ofxParticleEmitterShape::setRing( float innerRadius, float outerRadius )
+{
+	clear();
+	type = kEmitterShapeRing;
+
+	// Sampling the squared radius keeps the density even over the area
+	innerRadiusSq = innerRadius * innerRadius;
+	outerRadiusSq = outerRadius * outerRadius;
+}
+
+void ofxParticleEmitterShape::setPolyline( const vector<float>& xy, bool closed )
+{
+	clear();
+	if ( xy.size() < 4 ) return;
+
+	points = xy;
+	if ( closed )
+	{
+		points.push_back( xy[0] );
+		points.push_back( xy[1] );
+	}
+
+	// One weight per segment, its length
+	vector<float> lengths( points.size() / 2 - 1 );
+	for ( size_t i = 0; i < lengths.size(); i++ )
+	{
+		float dx = points[i * 2 + 2] - points[i * 2];
+		float dy = points[i * 2 + 3] - points[i * 2 + 1];
+		lengths[i] = sqrtf( dx * dx + dy * dy );
+	}
+	table.build( lengths );
+
+	type = kEmitterShapePolyline;
+}
+
+bool ofxParticleEmitterShape::setImageMask( const ofPixels& mask, float scale, float threshold )
+{
+	clear();
+
+	const int width = mask.getWidth();
+	const int height = mask.getHeight();
+	const int channels = mask.getNumChannels();
+	if ( width <= 0 || height <= 0 || channels <= 0 || width > 0xffff || height > 0xffff )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleEmitterShape::setImageMask() - unsupported mask size" );
+		return false;
+	}
+
+	// Use alpha when there is one, otherwise the first channel
+	const int weightChannel = ( channels == 2 || channels == 4 ) ? channels - 1 : 0;
+	const unsigned char* data = mask.getData();
+
+	vector<float> weights;
+	for ( int y = 0; y < height; y++ )
+	{
+		for ( int x = 0; x < width; x++ )
+		{
+			float w = data[( y * width + x ) * channels + weightChannel] / 255.0f;
+			if ( w <= threshold || w <= 0.0f ) continue;
+
+			pixels.push_back( ( (uint32_t)y << 16 ) | (uint32_t)x );
+			weights.push_back( w );
+		}
+	}
+
+	if ( pixels.empty() )
+	{
+		ofLog( OF_LOG_WARNING, "ofxParticleEmitterShape::setImageMask() - mask has no opaque pixels" );
+		return false;
+	}
+
+	table.build( weights );
+
+	maskScale = scale;
+	maskOffsetX = -width * 0.5f * scale;
+	maskOffsetY = -height * 0.5f * scale;
+	type = kEmitterShapeImage;
+
+	return true;
+}
+
+bool ofxParticleEmitterShape::loadImageMask( const std::string& filename, float scale, float threshold )
+{
+	ofImage image;
+	image.setUseTexture( false );
+	if ( !image.load( filename ) )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleEmitterShape::loadImageMask() - unable to load " + filename );
+		return false;
+	}
+
+	return setImageMask( image.getPixels(), scale, threshold );
+}
+
+void ofxParticleEmitterShape::sample( float u0, float u1, float u2, float u3, float& x, float& y ) const
+{
+	switch ( type )
+	{
+		case kEmitterShapeLine:
+			x = x1 + ( x2 - x1 ) * u0;
+			y = y1 + ( y2 - y1 ) * u0;
+			return;
+
+		case kEmitterShapeRing:
+		{
+			float angle = u0 * TWO_PI;
+			float radius = sqrtf( innerRadiusSq + ( outerRadiusSq - innerRadiusSq ) * u1 );
+			x = cosf( angle ) * radius;
+			y = sinf( angle ) * radius;
+			return;
+		}
+
+		case kEmitterShapePolyline:
+		{
+			int s = table.sample( u0, u3 );
+			const float* p = &points[s * 2];
+			x = p[0] + ( p[2] - p[0] ) * u1;
+			y = p[1] + ( p[3] - p[1] ) * u1;
+			return;
+		}
+
+		case kEmitterShapeImage:
+		{
+			// Pick a pixel and jitter within it
+			uint32_t pixel = pixels[table.sample( u0, u3 )];
+			x = maskOffsetX + ( ( pixel & 0xffff ) + u1 ) * maskScale;
+			y = maskOffsetY + ( ( pixel >> 16 ) + u2 ) * maskScale;
+			return;
+		}
+
+		default:
+			x = y = 0.0f;
+			return;
+	}
+}
@@ -0,0 +1,97 @@
+//
+// ofxParticleShape.h
+//
+// Spawn shapes for emitters.  Besides the default box (sourcePositionVariance), particles
+// can be born on a line, in a circle or ring, along a polyline or on the opaque pixels of
+// an image mask.  Weighted choices (polyline segments by length, mask pixels by alpha) go
+// through a precomputed alias table, so drawing a spawn point is O(1) for any shape.
+//
+
+#ifndef _OFX_PARTICLE_SHAPE
+#define _OFX_PARTICLE_SHAPE
+
+#include "ofMain.h"
+
+// Emitter shape type
+enum kEmitterShapes
+{
+	kEmitterShapeBox,			// sourcePosition +/- sourcePositionVariance
+	kEmitterShapeLine,
+	kEmitterShapeRing,			// Filled circle when the inner radius is 0
+	kEmitterShapePolyline,
+	kEmitterShapeImage
+};
+
+// ------------------------------------------------------------------------
+// ofxParticleAliasTable
+// ------------------------------------------------------------------------
+
+// Walker / Vose alias method: after an O(n) build, picks index i with probability
+// weights[i] / sum(weights) using two uniform numbers
+class ofxParticleAliasTable
+{
+
+public:
+
+	void	build( const vector<float>& weights );
+	void	clear() { probability.clear(); alias.clear(); }
+
+	// u picks the slot, coin decides between the slot and its alias.  The coin has to
+	// be a separate number, a large table would leave few bits of u's fraction for it
+	inline int sample( float u, float coin ) const
+	{
+		int i = (int)( u * probability.size() );
+		if ( i >= (int)probability.size() ) i = (int)probability.size() - 1;
+
+		return coin < probability[i] ? i : alias[i];
+	}
+
+	int		size() const { return (int)probability.size(); }
+
+protected:
+
+	vector<float>	probability;
+	vector<int>		alias;
+};
+
+// ------------------------------------------------------------------------
+// ofxParticleEmitterShape
+// ------------------------------------------------------------------------
+
+class ofxParticleEmitterShape
+{
+
+public:
+
+	ofxParticleEmitterShape();
+
+	// Back to the default box spawn
+	void	clear();
+
+	// Points are relative to the emitter's sourcePosition
+	void	setLine( float x1, float y1, float x2, float y2 );
+	void	setRing( float innerRadius, float outerRadius );
+	void	setPolyline( const vector<float>& xy, bool closed = false );
+
+	// Spawns on pixels whose alpha (or luminance for images without alpha) is above the
+	// threshold, weighted by it.  The mask is centred on sourcePosition and scaled
+	bool	setImageMask( const ofPixels& pixels, float scale = 1.0f, float threshold = 0.0f );
+	bool	loadImageMask( const std::string& filename, float scale = 1.0f, float threshold = 0.0f );
+
+	// Offset from sourcePosition for four uniform 0..1 numbers
+	void	sample( float u0, float u1, float u2, float u3, float& x, float& y ) const;
+
+	int		getType() const { return type; }
+
+protected:
+
+	int						type;
+	float					x1, y1, x2, y2;				// Line
+	float					innerRadiusSq, outerRadiusSq;	// Ring
+	vector<float>			points;						// Polyline, x/y pairs
+	ofxParticleAliasTable	table;						// Polyline segments or mask pixels
+	vector<uint32_t>		pixels;						// Mask pixel coordinates, y << 16 | x
+	float					maskScale, maskOffsetX, maskOffsetY;
+};
+
+#endif
@@ -0,0 +1,293 @@
+//
+// ofxParticleSharedMemory.cpp
+//
+
+#include "ofxParticleSharedMemory.h"
+
+#ifndef TARGET_WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The header is padded out to a cache line, slots start on cache line boundaries
+#define SHM_ALIGNMENT	64
+
+static inline size_t shmAlign( size_t bytes )
+{
+	return ( bytes + SHM_ALIGNMENT - 1 ) & ~(size_t)( SHM_ALIGNMENT - 1 );
+}
+
+static inline size_t shmHeaderBytes()
+{
+	return shmAlign( sizeof( SharedVertexHeader ) );
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleSharedMemoryWriter
+// ------------------------------------------------------------------------
+
+ofxParticleSharedMemoryWriter::ofxParticleSharedMemoryWriter()
+{
+	fd = -1;
+	size = 0;
+	header = NULL;
+	frame = 0;
+	writeSlot = -1;
+}
+
+ofxParticleSharedMemoryWriter::~ofxParticleSharedMemoryWriter()
+{
+	close();
+}
+
+bool ofxParticleSharedMemoryWriter::setup( const std::string& segmentName, int capacity, int slotCount )
+{
+	close();
+
+#ifdef TARGET_WIN32
+	ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryWriter::setup() - shared memory export needs a POSIX platform" );
+	return false;
+#else
+	if ( capacity <= 0 || slotCount < 2 )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryWriter::setup() - needs a positive capacity and at least 2 slots" );
+		return false;
+	}
+
+	const size_t stride = shmAlign( sizeof( SharedVertexSlot ) + sizeof( PointSprite ) * capacity );
+	const size_t bytes = shmHeaderBytes() + stride * slotCount;
+
+	// Start from a fresh segment so readers never see a previous layout
+	shm_unlink( segmentName.c_str() );
+	fd = shm_open( segmentName.c_str(), O_CREAT | O_RDWR, 0644 );
+	if ( fd < 0 || ftruncate( fd, bytes ) != 0 )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryWriter::setup() - unable to create " + segmentName );
+		close();
+		return false;
+	}
+
+	void* mapped = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	if ( mapped == MAP_FAILED )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryWriter::setup() - unable to map " + segmentName );
+		close();
+		return false;
+	}
+
+	name = segmentName;
+	size = bytes;
+	header = new ( mapped ) SharedVertexHeader;
+	header->slotCount = slotCount;
+	header->slotCapacity = capacity;
+	header->slotStride = stride;
+	header->blendFuncSource = header->blendFuncDestination = 0;
+	header->reserved = 0;
+	header->latestFrame.store( 0 );
+	assert( header->latestFrame.is_lock_free() );
+
+	for ( int i = 0; i < slotCount; i++ )
+	{
+		SharedVertexSlot* slot = new ( getSlot( i ) ) SharedVertexSlot;
+		slot->sequence.store( 0 );
+		slot->frame = 0;
+		slot->count = 0;
+		slot->reserved = 0;
+	}
+
+	// Readers check the magic last, so it only appears once the layout is complete
+	header->version = PARTICLE_SHM_VERSION;
+	std::atomic_thread_fence( std::memory_order_release );
+	header->magic = PARTICLE_SHM_MAGIC;
+
+	frame = 0;
+	writeSlot = -1;
+
+	return true;
+#endif
+}
+
+void ofxParticleSharedMemoryWriter::close()
+{
+#ifndef TARGET_WIN32
+	if ( header != NULL )
+		munmap( (void*)header, size );
+	if ( fd >= 0 )
+	{
+		::close( fd );
+		shm_unlink( name.c_str() );
+	}
+#endif
+	header = NULL;
+	fd = -1;
+	size = 0;
+	writeSlot = -1;
+}
+
+SharedVertexSlot* ofxParticleSharedMemoryWriter::getSlot( int slot ) const
+{
+	return (SharedVertexSlot*)( (unsigned char*)header + shmHeaderBytes() + (size_t)header->slotStride * slot );
+}
+
+PointSprite* ofxParticleSharedMemoryWriter::beginFrame()
+{
+	if ( header == NULL ) return NULL;
+
+	writeSlot = ( frame + 1 ) % header->slotCount;
+	SharedVertexSlot* slot = getSlot( writeSlot );
+
+	// Odd sequence marks the slot as being written
+	slot->sequence.store( slot->sequence.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+
+	return (PointSprite*)( slot + 1 );
+}
+
+void ofxParticleSharedMemoryWriter::endFrame( int count )
+{
+	if ( header == NULL || writeSlot < 0 ) return;
+
+	SharedVertexSlot* slot = getSlot( writeSlot );
+	frame++;
+	slot->frame = frame;
+	slot->count = MIN( (uint32_t)MAX( 0, count ), header->slotCapacity );
+
+	slot->sequence.store( slot->sequence.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+	header->latestFrame.store( frame, std::memory_order_release );
+
+	writeSlot = -1;
+}
+
+bool ofxParticleSharedMemoryWriter::publish( const ofxParticleEmitter& emitter )
+{
+	PointSprite* out = beginFrame();
+	if ( out == NULL ) return false;
+
+	header->blendFuncSource = emitter.blendFuncSource;
+	header->blendFuncDestination = emitter.blendFuncDestination;
+
+	endFrame( emitter.writeVertices( out, header->slotCapacity ) );
+	return true;
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleSharedMemoryReader
+// ------------------------------------------------------------------------
+
+ofxParticleSharedMemoryReader::ofxParticleSharedMemoryReader()
+{
+	fd = -1;
+	size = 0;
+	header = NULL;
+}
+
+ofxParticleSharedMemoryReader::~ofxParticleSharedMemoryReader()
+{
+	close();
+}
+
+bool ofxParticleSharedMemoryReader::setup( const std::string& segmentName )
+{
+	close();
+
+#ifdef TARGET_WIN32
+	ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryReader::setup() - shared memory export needs a POSIX platform" );
+	return false;
+#else
+	fd = shm_open( segmentName.c_str(), O_RDONLY, 0 );
+	if ( fd < 0 )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryReader::setup() - unable to open " + segmentName );
+		return false;
+	}
+
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < shmHeaderBytes() )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryReader::setup() - " + segmentName + " is not ready" );
+		close();
+		return false;
+	}
+
+	void* mapped = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	if ( mapped == MAP_FAILED )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryReader::setup() - unable to map " + segmentName );
+		close();
+		return false;
+	}
+
+	size = st.st_size;
+	header = (const SharedVertexHeader*)mapped;
+
+	bool valid = header->magic == PARTICLE_SHM_MAGIC;
+	std::atomic_thread_fence( std::memory_order_acquire );
+	// acquire() trusts slotCapacity, so a slot must really hold that many vertices
+	valid = valid && header->version == PARTICLE_SHM_VERSION && header->slotCount > 0 &&
+			sizeof( SharedVertexSlot ) + (uint64_t)header->slotCapacity * sizeof( PointSprite ) <= header->slotStride &&
+			( header->slotStride & ( SHM_ALIGNMENT - 1 ) ) == 0 &&
+			(uint64_t)header->slotStride * header->slotCount <= size - shmHeaderBytes();
+	if ( !valid )
+	{
+		ofLog( OF_LOG_ERROR, "ofxParticleSharedMemoryReader::setup() - " + segmentName + " is not a particle vertex segment" );
+		close();
+		return false;
+	}
+
+	return true;
+#endif
+}
+
+void ofxParticleSharedMemoryReader::close()
+{
+#ifndef TARGET_WIN32
+	if ( header != NULL )
+		munmap( (void*)header, size );
+	if ( fd >= 0 )
+		::close( fd );
+#endif
+	header = NULL;
+	fd = -1;
+	size = 0;
+}
+
+const SharedVertexSlot* ofxParticleSharedMemoryReader::getSlot( int slot ) const
+{
+	return (const SharedVertexSlot*)( (const unsigned char*)header + shmHeaderBytes() + (size_t)header->slotStride * slot );
+}
+
+uint64_t ofxParticleSharedMemoryReader::getLatestFrame() const
+{
+	return header != NULL ? header->latestFrame.load( std::memory_order_acquire ) : 0;
+}
+
+bool ofxParticleSharedMemoryReader::acquire( SharedVertexFrame& out ) const
+{
+	uint64_t latest = getLatestFrame();
+	if ( latest == 0 ) return false;
+
+	int index = latest % header->slotCount;
+	const SharedVertexSlot* slot = getSlot( index );
+
+	uint64_t sequence = slot->sequence.load( std::memory_order_acquire );
+	if ( sequence & 1 ) return false;
+
+	out.vertices = (const PointSprite*)( slot + 1 );
+	out.count = MIN( slot->count, header->slotCapacity );
+	out.frame = slot->frame;
+	out.sequence = sequence;
+	out.slot = index;
+
+	// The count and frame number were read outside the seqlock, check them too
+	return validate( out );
+}
+
+bool ofxParticleSharedMemoryReader::validate( const SharedVertexFrame& frame ) const
+{
+	if ( header == NULL || frame.slot < 0 || frame.slot >= (int)header->slotCount ) return false;
+
+	std::atomic_thread_fence( std::memory_order_acquire );
+	return getSlot( frame.slot )->sequence.load( std::memory_order_relaxed ) == frame.sequence;
+}
@@ -0,0 +1,131 @@
+//
+// ofxParticleSharedMemory.h
+//
+// Publishes an emitter's vertex output into a POSIX shared memory ring so another
+// process can render or record it without serialization.  Every slot carries a
+// seqlock sequence number: the writer makes it odd while filling the slot and even
+// when done, and a reader that sees the same even value before and after using the
+// vertices knows it got a consistent frame.  Readers map the segment read-only and
+// use the vertices in place.
+//
+
+#ifndef _OFX_PARTICLE_SHARED_MEMORY
+#define _OFX_PARTICLE_SHARED_MEMORY
+
+#include "ofxParticleEmitter.h"
+
+#include <atomic>
+
+#define PARTICLE_SHM_MAGIC		0x4d485350	// "PSHM"
+#define PARTICLE_SHM_VERSION	1
+
+typedef struct
+{
+	uint32_t				magic;
+	uint32_t				version;
+	uint32_t				slotCount;
+	uint32_t				slotCapacity;		// Vertices per slot
+	uint32_t				slotStride;			// Bytes from one slot to the next
+	int32_t					blendFuncSource;
+	int32_t					blendFuncDestination;
+	uint32_t				reserved;
+	std::atomic<uint64_t>	latestFrame;		// Last published frame, 0 before the first
+} SharedVertexHeader;
+
+typedef struct
+{
+	std::atomic<uint64_t>	sequence;			// Odd while the writer is filling the slot
+	uint64_t				frame;
+	uint32_t				count;
+	uint32_t				reserved;
+} SharedVertexSlot;
+
+// A frame borrowed from the mapping by ofxParticleSharedMemoryReader::acquire()
+typedef struct
+{
+	const PointSprite*	vertices;
+	int					count;
+	uint64_t			frame;
+	uint64_t			sequence;
+	int					slot;
+} SharedVertexFrame;
+
+// ------------------------------------------------------------------------
+// ofxParticleSharedMemoryWriter
+// ------------------------------------------------------------------------
+
+class ofxParticleSharedMemoryWriter
+{
+
+public:
+
+	ofxParticleSharedMemoryWriter();
+	~ofxParticleSharedMemoryWriter();
+
+	// Creates (or replaces) the segment.  name follows shm_open(), e.g. "/particles".
+	// More slots give readers longer to use a frame before it is overwritten
+	bool	setup( const std::string& name, int capacity, int slotCount = 3 );
+	void	close();
+
+	// Writes an emitter's current vertices straight into the next slot
+	bool	publish( const ofxParticleEmitter& emitter );
+
+	// Or write straight into the slot: beginFrame() returns space for getCapacity()
+	// vertices, endFrame() publishes the first count of them
+	PointSprite*	beginFrame();
+	void			endFrame( int count );
+
+	bool		isSetup() const { return header != NULL; }
+	int			getCapacity() const { return header != NULL ? header->slotCapacity : 0; }
+	uint64_t	getFrame() const { return frame; }
+
+protected:
+
+	SharedVertexSlot*	getSlot( int slot ) const;
+
+	std::string				name;
+	int						fd;
+	size_t					size;
+	SharedVertexHeader*		header;
+	uint64_t				frame;
+	int						writeSlot;		// Slot between beginFrame() and endFrame(), -1 otherwise
+};
+
+// ------------------------------------------------------------------------
+// ofxParticleSharedMemoryReader
+// ------------------------------------------------------------------------
+
+class ofxParticleSharedMemoryReader
+{
+
+public:
+
+	ofxParticleSharedMemoryReader();
+	~ofxParticleSharedMemoryReader();
+
+	bool	setup( const std::string& name );
+	void	close();
+
+	// Points out at the latest complete frame without copying.  Returns false when
+	// nothing has been published yet or the slot is being rewritten right now
+	bool	acquire( SharedVertexFrame& out ) const;
+
+	// True if the frame was not overwritten while it was in use.  Call after reading
+	// (or uploading) the vertices and discard the result when it fails
+	bool	validate( const SharedVertexFrame& frame ) const;
+
+	bool		isSetup() const { return header != NULL; }
+	uint64_t	getLatestFrame() const;
+	int			getBlendFuncSource() const { return header != NULL ? header->blendFuncSource : 0; }
+	int			getBlendFuncDestination() const { return header != NULL ? header->blendFuncDestination : 0; }
+
+protected:
+
+	const SharedVertexSlot*	getSlot( int slot ) const;
+
+	int							fd;
+	size_t						size;
+	const SharedVertexHeader*	header;
+};
+
+#endif
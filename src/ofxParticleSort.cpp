@@ -0,0 +1,163 @@
+//
+// ofxParticleSort.cpp
+//
+
+#include "ofxParticleSort.h"
+
+#define RADIX_BITS		8
+#define RADIX_BUCKETS	(1 << RADIX_BITS)
+
+ofxParticleSorter::ofxParticleSorter()
+{
+	count = 0;
+	lastMethod = kSortNone;
+}
+
+uint32_t* ofxParticleSorter::beginKeys( int numKeys )
+{
+	count = MAX( 0, numKeys );
+	if ( (int)keys.size() < count )
+	{
+		keys.resize( count );
+		tmpKeys.resize( count );
+		indices.resize( count );
+		tmpIndices.resize( count );
+	}
+
+	return count > 0 ? &keys[0] : NULL;
+}
+
+const int* ofxParticleSorter::sort()
+{
+	lastMethod = kSortNone;
+	if ( count < 2 ) return NULL;
+
+	// Count the places where the order breaks.  Most frames only a few particles were
+	// born or swapped into a hole since the last sort
+	int descents = 0, firstDescent = 0;
+	for ( int i = 1; i < count; i++ )
+	{
+		if ( keys[i] < keys[i - 1] )
+		{
+			if ( descents++ == 0 )
+				firstDescent = i;
+		}
+	}
+	if ( descents == 0 )
+		return NULL;
+
+	// Two sorted runs, typically the survivors of the last frame with this frame's
+	// births appended, are merged in one pass however far apart they belong
+	if ( descents == 1 )
+	{
+		mergeRuns( firstDescent );
+		lastMethod = kSortMerge;
+		return &indices[0];
+	}
+
+	for ( int i = 0; i < count; i++ )
+		indices[i] = i;
+
+	// Insertion sort wins while few elements are out of place, but give up as soon as
+	// it costs more than the radix passes would
+	if ( descents <= count / 64 + 1 && insertionSort( count * 4 ) )
+		lastMethod = kSortInsertion;
+	else
+	{
+		radixSort();
+		lastMethod = kSortRadix;
+	}
+
+	return &indices[0];
+}
+
+void ofxParticleSorter::mergeRuns( int split )
+{
+	int a = 0, b = split, out = 0;
+
+	// Ties take from the first run so the merge is stable
+	while ( a < split && b < count )
+		indices[out++] = keys[b] < keys[a] ? b++ : a++;
+	while ( a < split )
+		indices[out++] = a++;
+	while ( b < count )
+		indices[out++] = b++;
+}
+
+bool ofxParticleSorter::insertionSort( int maxShifts )
+{
+	int shifts = 0;
+
+	for ( int i = 1; i < count; i++ )
+	{
+		uint32_t key = keys[i];
+		int index = indices[i];
+		int j = i - 1;
+
+		while ( j >= 0 && keys[j] > key )
+		{
+			keys[j + 1] = keys[j];
+			indices[j + 1] = indices[j];
+			j--;
+
+			// The partially sorted keys are still valid radix input
+			if ( ++shifts > maxShifts )
+			{
+				keys[j + 1] = key;
+				indices[j + 1] = index;
+				return false;
+			}
+		}
+
+		keys[j + 1] = key;
+		indices[j + 1] = index;
+	}
+
+	return true;
+}
+
+void ofxParticleSorter::radixSort()
+{
+	uint32_t* srcKeys = &keys[0];
+	uint32_t* dstKeys = &tmpKeys[0];
+	int* srcIndices = &indices[0];
+	int* dstIndices = &tmpIndices[0];
+
+	int histogram[RADIX_BUCKETS];
+
+	for ( int shift = 0; shift < 32; shift += RADIX_BITS )
+	{
+		memset( histogram, 0, sizeof( histogram ) );
+		for ( int i = 0; i < count; i++ )
+			histogram[( srcKeys[i] >> shift ) & ( RADIX_BUCKETS - 1 )]++;
+
+		// Every key has the same digit, this pass would not change anything
+		if ( histogram[( srcKeys[0] >> shift ) & ( RADIX_BUCKETS - 1 )] == count )
+			continue;
+
+		int offset = 0;
+		for ( int b = 0; b < RADIX_BUCKETS; b++ )
+		{
+			int n = histogram[b];
+			histogram[b] = offset;
+			offset += n;
+		}
+
+		for ( int i = 0; i < count; i++ )
+		{
+			int slot = histogram[( srcKeys[i] >> shift ) & ( RADIX_BUCKETS - 1 )]++;
+			dstKeys[slot] = srcKeys[i];
+			dstIndices[slot] = srcIndices[i];
+		}
+
+		std::swap( srcKeys, dstKeys );
+		std::swap( srcIndices, dstIndices );
+	}
+
+	// Make sure the result ends up in the primary arrays
+	if ( srcKeys != &keys[0] )
+	{
+		memcpy( &keys[0], srcKeys, sizeof( uint32_t ) * count );
+		memcpy( &indices[0], srcIndices, sizeof( int ) * count );
+	}
+}
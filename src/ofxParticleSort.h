@@ -0,0 +1,57 @@
+//
+// ofxParticleSort.h
+//
+// Key/index sorter used to give alpha blended emitters a stable draw order.  Keys that
+// are already in order cost one pass, two sorted runs are merged, a nearly sorted frame
+// is fixed up with a bounded insertion sort and anything else goes through an LSD radix
+// sort, all O(n).
+//
+
+#ifndef _OFX_PARTICLE_SORT
+#define _OFX_PARTICLE_SORT
+
+#include "ofMain.h"
+
+// Maps a float to an unsigned key with the same ordering
+static inline uint32_t particleSortKey( float value )
+{
+	uint32_t bits;
+	memcpy( &bits, &value, sizeof( bits ) );
+	return bits ^ ( ( bits >> 31 ) ? 0xffffffffu : 0x80000000u );
+}
+
+// ------------------------------------------------------------------------
+// ofxParticleSorter
+// ------------------------------------------------------------------------
+
+class ofxParticleSorter
+{
+
+public:
+
+	ofxParticleSorter();
+
+	// Returns the key array to fill, one key per element in the current order
+	uint32_t*	beginKeys( int count );
+
+	// Sorts the keys ascending.  Returns the order as source indices, or NULL when the
+	// elements are already in order and nothing needs to move
+	const int*	sort();
+
+	// How the last sort() was resolved, for profiling
+	enum { kSortNone, kSortMerge, kSortInsertion, kSortRadix };
+	int			getLastMethod() const { return lastMethod; }
+
+protected:
+
+	void		mergeRuns( int split );
+	bool		insertionSort( int maxShifts );
+	void		radixSort();
+
+	int					count;
+	int					lastMethod;
+	vector<uint32_t>	keys, tmpKeys;
+	vector<int>			indices, tmpIndices;
+};
+
+#endif